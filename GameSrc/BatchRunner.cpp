@@ -0,0 +1,282 @@
+/*
+Расчет уровней без окна и видеокарты. Собирается в отдельный исполняемый файл PuddleBatch.
+Каждый уровень загружается, рассчитывается заданное число шагов физики, после чего
+печатается отчет: время расчета и число молекул, вылетевших из ёмкости.
+
+Использование:
+PuddleBatch [уровни] [-steps N] [-rate N] [-integrator Euler|Verlet] [-threads N] [-kernel Scalar|SSE|AVX|NEON] [-output папка]
+PuddleBatch -replay файл.rpl [-threads N] [-kernel Scalar|SSE|AVX|NEON]
+
+Уровни указываются именами файлов в папке GameData/Scenes. Если уровни не указаны,
+рассчитываются все уровни из списка. С параметром -output конечное состояние каждого
+уровня записывается в указанную папку в двоичном формате (.lvl). Параметры -rate
+(число шагов физики в секунду) и -integrator позволяют проверить, как уровни ведут себя
+с более длинными шагами.
+С параметром -replay воспроизводится запись прохождения уровня (см. Replay.h) и проверяется,
+что конечное состояние побитово совпало с записанным.
+Код возврата ненулевой, если хотя бы один уровень не загрузился или развалился,
+или если воспроизведение не совпало с записью.
+*/
+
+#include "ContainerLogic.h"
+#include "Urho3DAliases.h"
+#include "Config.h"
+#include "LevelLoader.h"
+
+// Число шагов физики по умолчанию (10 секунд игрового времени).
+#define DEFAULT_BATCH_STEPS (10 * DEFAULT_PHYSICS_RATE)
+
+class BatchRunner : public Application
+{
+    URHO3D_OBJECT(BatchRunner, Application);
+
+public:
+    BatchRunner(Context* context) : Application(context)
+    {
+        ContainerLogic::RegisterObject(context);
+        MoleculeGroup::RegisterObject(context);
+    }
+
+    void Setup()
+    {
+        ParseArguments();
+
+        engineParameters_["Headless"] = true;
+        engineParameters_["Sound"] = false;
+        engineParameters_["LogName"] = String::EMPTY;
+        engineParameters_["ResourcePaths"] = "GameData;Data;CoreData";
+
+        // Если число потоков задано, то потоки создаются вручную в Start().
+        if (numThreads_ >= 0)
+            engineParameters_["WorkerThreads"] = false;
+    }
+
+    void Start()
+    {
+        if (numThreads_ > 0)
+            GetSubsystem<WorkQueue>()->CreateThreads(numThreads_);
+
+        context_->RegisterSubsystem(new Config(context_));
+        context_->RegisterSubsystem(new LevelLoader(context_));
+
+        // Если уровни не указаны, то рассчитываем все уровни из списка.
+        if (levelNames_.Empty())
+            levelNames_ = CONFIG->GetLevelList();
+
+        if (!outputDir_.Empty())
+            FILE_SYSTEM->CreateDir(outputDir_);
+
+        CreateScene();
+
+        PrintLine(ToString("Kernel: %s, threads: %d, steps: %d, rate: %d, integrator: %s",
+            GetForceKernelName(containerLogic_->GetForceKernel()), GetSubsystem<WorkQueue>()->GetNumThreads(), numSteps_,
+            (int)(1.0f / containerLogic_->GetPhysicsStep() + 0.5f), GetIntegratorName(containerLogic_->GetIntegrator())));
+
+        bool success = true;
+        if (!replayFileName_.Empty())
+        {
+            success = RunReplay(replayFileName_);
+        }
+        else
+        {
+            for (unsigned i = 0; i < levelNames_.Size(); i++)
+                success &= RunLevel(levelNames_[i]);
+        }
+
+        if (!success)
+            exitCode_ = EXIT_FAILURE;
+
+        // Кадры не нужны, выходим сразу.
+        engine_->Exit();
+    }
+
+private:
+    // Имена файлов уровней.
+    Vector<String> levelNames_;
+    // Число шагов физики для каждого уровня.
+    int numSteps_ = DEFAULT_BATCH_STEPS;
+    // Число рабочих потоков. Если отрицательное, то выбирается движком.
+    int numThreads_ = -1;
+    // Реализация расчета сил. Если пустая строка, то самая быстрая.
+    String kernelName_;
+    // Число шагов физики в секунду. Если ноль, то как в игре.
+    int physicsRate_ = 0;
+    // Способ интегрирования. Если пустая строка, то как в игре.
+    String integratorName_;
+    // Папка для конечных состояний уровней. Если пустая строка, то они не записываются.
+    String outputDir_;
+    // Запись для воспроизведения. Если пустая строка, то рассчитываются уровни.
+    String replayFileName_;
+
+    SharedPtr<Scene> scene_;
+    WeakPtr<ContainerLogic> containerLogic_;
+    WeakPtr<Node> bottomNode_;
+
+    void ParseArguments()
+    {
+        const Vector<String>& arguments = GetArguments();
+
+        for (unsigned i = 0; i < arguments.Size(); i++)
+        {
+            const String& argument = arguments[i];
+            String value = i + 1 < arguments.Size() ? arguments[i + 1] : String::EMPTY;
+
+            if (argument == "-steps")
+            {
+                numSteps_ = Max(ToInt(value), 0);
+                i++;
+            }
+            else if (argument == "-threads")
+            {
+                numThreads_ = Max(ToInt(value), 0);
+                i++;
+            }
+            else if (argument == "-kernel")
+            {
+                kernelName_ = value;
+                i++;
+            }
+            else if (argument == "-rate")
+            {
+                physicsRate_ = Max(ToInt(value), 0);
+                i++;
+            }
+            else if (argument == "-integrator")
+            {
+                integratorName_ = value;
+                i++;
+            }
+            else if (argument == "-output")
+            {
+                outputDir_ = AddTrailingSlash(value);
+                i++;
+            }
+            else if (argument == "-replay")
+            {
+                replayFileName_ = value;
+                i++;
+            }
+            // Остальные параметры, начинающиеся с минуса, принадлежат движку.
+            else if (!argument.StartsWith("-"))
+            {
+                levelNames_.Push(argument);
+            }
+        }
+    }
+
+    // Сцена содержит только то, что нужно для физики: ёмкость и ее дно (радиус ёмкости
+    // хранится в масштабе дна).
+    void CreateScene()
+    {
+        scene_ = new Scene(context_);
+        Node* containerNode = scene_->CreateChild("Container");
+        containerLogic_ = containerNode->CreateComponent<ContainerLogic>();
+        bottomNode_ = scene_->CreateChild("ContainerBottom");
+
+        ForceKernel kernel;
+        if (!kernelName_.Empty() && GetForceKernelByName(kernelName_.CString(), kernel))
+            containerLogic_->SetForceKernel(kernel);
+
+        if (physicsRate_ > 0)
+            containerLogic_->SetPhysicsRate(physicsRate_);
+
+        PhysicsIntegrator integrator;
+        if (!integratorName_.Empty() && GetIntegratorByName(integratorName_.CString(), integrator))
+            containerLogic_->SetIntegrator(integrator);
+    }
+
+    // Уровни из списка загружаются так же, как в игре (в том числе из архива).
+    // Остальные ищутся в папке GameData/Scenes.
+    bool LoadLevel(const String& name, LevelData& level)
+    {
+        const Vector<String>& levelList = CONFIG->GetLevelList();
+
+        for (int i = 0; i < (int)levelList.Size(); i++)
+        {
+            if (levelList[i] == name)
+                return LEVEL_LOADER->GetLevel(i, level);
+        }
+
+        return LoadLevelFile(context_, FILE_SYSTEM->GetProgramDir() + "GameData/Scenes/" + name, level);
+    }
+
+    // Рассчитывает уровень и печатает строку отчета. Возвращает false, если уровень
+    // не загрузился или молекулы вылетели из ёмкости.
+    bool RunLevel(const String& name)
+    {
+        LevelData level;
+        if (!LoadLevel(name, level))
+        {
+            PrintLine(name + ": failed to load", true);
+            return false;
+        }
+
+        bottomNode_->SetScale(level.containerRadius_);
+        containerLogic_->LoadLevelData(level);
+
+        // Разлепление совпавших молекул использует случайные числа. Одинаковое зерно
+        // делает результат уровня независимым от порядка расчета.
+        containerLogic_->SetRandomSeed(1);
+
+        HiresTimer timer;
+        containerLogic_->StepPhysics(numSteps_);
+        long long elapsed = timer.GetUSec(false);
+
+        containerLogic_->SaveLevelData(level);
+
+        // Молекулы, центр которых дальше радиуса молекулы от стенки, вылетели из ёмкости.
+        // Стенка проверяется по форме ёмкости, а не по описанной окружности.
+        ContainerShape shape;
+        shape.SetVertices(level.containerShape_);
+        shape.SetScale(level.containerRadius_);
+        int numEscaped = 0;
+        for (int i = 0; i < level.GetNumMolecules(); i++)
+        {
+            float x = level.posX_[i];
+            float y = level.posY_[i];
+            float normalX;
+            float normalY;
+
+            if (IsNaN(x) || IsNaN(y) || shape.GetDistance(x, y, normalX, normalY) > MOLECULE_RADIUS)
+                numEscaped++;
+        }
+
+        if (!outputDir_.Empty())
+        {
+            File file(context_, outputDir_ + GetFileName(name) + ".lvl", FILE_WRITE);
+            WriteLevelData(file, level);
+        }
+
+        float milliseconds = elapsed / 1000.0f;
+        PrintLine(ToString("%s: molecules %d, colors %d, %.1f ms, %.3f ms/step, escaped %d, awake %d", name.CString(),
+            level.GetNumMolecules(), containerLogic_->GetNumRemainingColors(), milliseconds,
+            numSteps_ > 0 ? milliseconds / numSteps_ : 0.0f, numEscaped, containerLogic_->GetNumAwakeMolecules()));
+
+        return numEscaped == 0;
+    }
+
+    // Воспроизводит запись и печатает строку отчета. Возвращает false, если запись
+    // не загрузилась или конечное состояние не совпало с записанным.
+    bool RunReplay(const String& fileName)
+    {
+        Replay replay;
+        File file(context_, fileName, FILE_READ);
+        if (!file.IsOpen() || !ReadReplay(file, replay))
+        {
+            PrintLine(fileName + ": failed to load", true);
+            return false;
+        }
+
+        HiresTimer timer;
+        bool match = containerLogic_->PlayReplay(replay);
+        long long elapsed = timer.GetUSec(false);
+
+        PrintLine(ToString("%s: molecules %d, fills %d, steps %u, %.1f ms, %s", fileName.CString(),
+            replay.level_.GetNumMolecules(), replay.fills_.Size(), replay.numSteps_, elapsed / 1000.0f,
+            match ? "match" : "MISMATCH"), !match);
+
+        return match;
+    }
+};
+
+URHO3D_DEFINE_APPLICATION_MAIN(BatchRunner)
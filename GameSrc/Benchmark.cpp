@@ -0,0 +1,376 @@
+/*
+Замеры скорости физики на синтетических ёмкостях. Собирается в отдельный исполняемый файл PuddleBenchmark.
+Ёмкости заполняются молекулами в случайных местах (так же, как клавишей ПРОБЕЛ в редакторе)
+с разными наборами цветов. Отдельно замеряются расчет сил, перемещение молекул, заливка
+и проверка на победу.
+
+Использование:
+PuddleBenchmark [-molecules N] [-steps N] [-rate N] [-integrator Euler|Verlet] [-threads N] [-kernel Scalar|SSE|AVX|NEON] [-output файл]
+PuddleBenchmark -verify-kernels [-molecules N] [-threads N] [-output файл]
+
+Результаты выводятся в формате JSON (в файл, если указан параметр -output), чтобы их можно
+было сравнивать между сборками.
+
+С параметром -verify-kernels вместо замеров проверяется, что все реализации расчета сил,
+поддерживаемые процессором, дают побитово одинаковые силы на одних и тех же ёмкостях.
+Если хоть одна сила отличается, то программа завершается с ненулевым кодом.
+*/
+
+#include "ContainerLogic.h"
+#include "Urho3DAliases.h"
+#include "Utils.h"
+#include <chrono>
+#include <cstring>
+
+// Число молекул на единицу площади в уровнях игры. Радиус синтетической ёмкости
+// подбирается так, чтобы плотность была такой же.
+#define BENCHMARK_DENSITY 1.4f
+// Шаги физики перед замерами, за которые случайно расставленные молекулы расталкиваются.
+#define WARMUP_STEPS 60
+// Число заливок на один замер.
+#define NUM_FILLS 20
+// Число проверок на победу на один замер.
+#define NUM_SINGLE_COLOR_CHECKS 1000000
+
+// Число молекул в синтетических ёмкостях.
+static const int moleculeCounts[] = { 100, 1000, 10000, 100000 };
+
+// Набор цветов: имя для отчета и функция, выбирающая цвет молекулы по ее позиции.
+struct ColorMix
+{
+    const char* name_;
+    int (*getColor)(const Vector3& pos);
+};
+
+static const ColorMix colorMixes[] = {
+    // Все молекулы одного цвета. Заливка обходит всю ёмкость.
+    { "single", [](const Vector3& pos) { return 0; } },
+    // Две половины ёмкости. Крупные области, как в конце уровня.
+    { "halves", [](const Vector3& pos) { return pos.x_ < 0.0f ? 0 : 1; } },
+    // Два случайных цвета.
+    { "random2", [](const Vector3& pos) { return Random(2); } },
+    // Все цвета вперемешку. Мелкие области, как в начале уровня.
+    { "random7", [](const Vector3& pos) { return Random(NUM_COLORS); } }
+};
+
+// Время выполнения в наносекундах. Таймеры движка считают микросекунды, а этого
+// не хватает для замера одного шага маленькой ёмкости.
+typedef std::chrono::steady_clock BenchmarkClock;
+
+static long long ElapsedNSec(BenchmarkClock::time_point begin)
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(BenchmarkClock::now() - begin).count();
+}
+
+class Benchmark : public Application
+{
+    URHO3D_OBJECT(Benchmark, Application);
+
+public:
+    Benchmark(Context* context) : Application(context)
+    {
+        ContainerLogic::RegisterObject(context);
+        MoleculeGroup::RegisterObject(context);
+    }
+
+    void Setup()
+    {
+        ParseArguments();
+
+        engineParameters_["Headless"] = true;
+        engineParameters_["Sound"] = false;
+        engineParameters_["LogName"] = String::EMPTY;
+        engineParameters_["ResourcePaths"] = "GameData;Data;CoreData";
+
+        // Если результаты выводятся в консоль, то лог не должен в них попадать.
+        if (outputFileName_.Empty())
+            engineParameters_["LogQuiet"] = true;
+
+        // Если число потоков задано, то потоки создаются вручную в Start().
+        if (numThreads_ >= 0)
+            engineParameters_["WorkerThreads"] = false;
+    }
+
+    void Start()
+    {
+        if (numThreads_ > 0)
+            GetSubsystem<WorkQueue>()->CreateThreads(numThreads_);
+
+        CreateScene();
+
+        JSONFile jsonFile(context_);
+        JSONValue& root = jsonFile.GetRoot();
+        root.Set("kernel", GetForceKernelName(containerLogic_->GetForceKernel()));
+        root.Set("threads", GetSubsystem<WorkQueue>()->GetNumThreads());
+        root.Set("rate", (int)(1.0f / containerLogic_->GetPhysicsStep() + 0.5f));
+        root.Set("integrator", GetIntegratorName(containerLogic_->GetIntegrator()));
+
+        JSONValue results;
+        for (int numMolecules : moleculeCounts)
+        {
+            if (numMolecules_ > 0 && numMolecules != numMolecules_)
+                continue;
+
+            for (const ColorMix& mix : colorMixes)
+                results.Push(verifyKernels_ ? VerifyKernels(numMolecules, mix) : RunCase(numMolecules, mix));
+        }
+        root.Set("results", results);
+
+        if (outputFileName_.Empty())
+        {
+            VectorBuffer buffer;
+            jsonFile.Save(buffer, "  ");
+            PrintLine(String((const char*)buffer.GetData(), buffer.GetSize()));
+        }
+        else
+        {
+            File file(context_, outputFileName_, FILE_WRITE);
+            if (!jsonFile.Save(file, "  "))
+                exitCode_ = EXIT_FAILURE;
+        }
+
+        // Кадры не нужны, выходим сразу.
+        engine_->Exit();
+    }
+
+private:
+    // Если больше нуля, то замеряется только ёмкость с таким числом молекул.
+    int numMolecules_ = 0;
+    // Число шагов физики на замер. Если ноль, то зависит от числа молекул.
+    int numSteps_ = 0;
+    // Число рабочих потоков. Если отрицательное, то выбирается движком.
+    int numThreads_ = -1;
+    // Реализация расчета сил. Если пустая строка, то самая быстрая.
+    String kernelName_;
+    // Число шагов физики в секунду. Если ноль, то как в игре.
+    int physicsRate_ = 0;
+    // Способ интегрирования. Если пустая строка, то как в игре.
+    String integratorName_;
+    // Файл для результатов. Если пустая строка, то результаты печатаются в консоль.
+    String outputFileName_;
+    // Сравнивать реализации расчета сил вместо замеров.
+    bool verifyKernels_ = false;
+
+    SharedPtr<Scene> scene_;
+    WeakPtr<ContainerLogic> containerLogic_;
+    WeakPtr<Node> bottomNode_;
+
+    void ParseArguments()
+    {
+        const Vector<String>& arguments = GetArguments();
+
+        for (unsigned i = 0; i < arguments.Size(); i++)
+        {
+            const String& argument = arguments[i];
+
+            // Параметры без значения.
+            if (argument == "-verify-kernels")
+            {
+                verifyKernels_ = true;
+                continue;
+            }
+
+            if (i + 1 >= arguments.Size())
+                break;
+
+            const String& value = arguments[i + 1];
+
+            if (argument == "-molecules")
+                numMolecules_ = ToInt(value);
+            else if (argument == "-steps")
+                numSteps_ = Max(ToInt(value), 0);
+            else if (argument == "-threads")
+                numThreads_ = Max(ToInt(value), 0);
+            else if (argument == "-kernel")
+                kernelName_ = value;
+            else if (argument == "-rate")
+                physicsRate_ = Max(ToInt(value), 0);
+            else if (argument == "-integrator")
+                integratorName_ = value;
+            else if (argument == "-output")
+                outputFileName_ = value;
+            else
+                continue;
+
+            i++;
+        }
+    }
+
+    // Сцена содержит только то, что нужно для физики: ёмкость и ее дно (радиус ёмкости
+    // хранится в масштабе дна).
+    void CreateScene()
+    {
+        scene_ = new Scene(context_);
+        Node* containerNode = scene_->CreateChild("Container");
+        containerLogic_ = containerNode->CreateComponent<ContainerLogic>();
+        bottomNode_ = scene_->CreateChild("ContainerBottom");
+
+        ForceKernel kernel;
+        if (!kernelName_.Empty() && GetForceKernelByName(kernelName_.CString(), kernel))
+            containerLogic_->SetForceKernel(kernel);
+
+        if (physicsRate_ > 0)
+            containerLogic_->SetPhysicsRate(physicsRate_);
+
+        PhysicsIntegrator integrator;
+        if (!integratorName_.Empty() && GetIntegratorByName(integratorName_.CString(), integrator))
+            containerLogic_->SetIntegrator(integrator);
+    }
+
+    // Заполняет ёмкость и расталкивает молекулы.
+    void PrepareCase(int numMolecules, const ColorMix& mix)
+    {
+        // Одинаковое зерно для всех замеров, чтобы ёмкости не менялись между запусками.
+        SetRandomSeed(1);
+
+        // Ёмкость с той же плотностью, что и в уровнях.
+        LevelData level;
+        level.containerRadius_ = sqrtf(numMolecules / (M_PI * BENCHMARK_DENSITY));
+        level.Resize(numMolecules);
+
+        for (int i = 0; i < numMolecules; i++)
+        {
+            Vector3 pos = RandomPointInCircle(0.1f, level.containerRadius_ - MOLECULE_RADIUS);
+            level.posX_[i] = pos.x_;
+            level.posY_[i] = pos.y_;
+            level.speedX_[i] = level.speedY_[i] = 0.0f;
+            level.colors_[i] = (unsigned char)mix.getColor(pos);
+        }
+
+        bottomNode_->SetScale(level.containerRadius_);
+        containerLogic_->LoadLevelData(level);
+        containerLogic_->SetRandomSeed(1);
+        containerLogic_->StepPhysics(WARMUP_STEPS);
+    }
+
+    JSONValue RunCase(int numMolecules, const ColorMix& mix)
+    {
+        PrepareCase(numMolecules, mix);
+
+        // Маленькие ёмкости считаются быстро, поэтому для них шагов больше.
+        int numSteps = numSteps_ > 0 ? numSteps_ : Clamp(1000000 / numMolecules, 10, 1000);
+        float timeStep = containerLogic_->GetPhysicsStep();
+        long long forcesNSec = 0;
+        long long positionsNSec = 0;
+        // Спящие молекулы не обрабатываются, поэтому время делится на число молекул,
+        // которые не спали на каждом шаге, а не на число всех молекул.
+        double awakeMoleculeSteps = 0.0;
+
+        for (int step = 0; step < numSteps; step++)
+        {
+            BenchmarkClock::time_point begin = BenchmarkClock::now();
+            containerLogic_->UpdateForces();
+            forcesNSec += ElapsedNSec(begin);
+
+            // Молекулы засыпают внутри UpdateForces(), и на этом шаге уже не обрабатываются.
+            awakeMoleculeSteps += containerLogic_->GetNumAwakeMolecules();
+
+            begin = BenchmarkClock::now();
+            containerLogic_->UpdatePositions(timeStep);
+            positionsNSec += ElapsedNSec(begin);
+        }
+
+        // Заливка всегда меняет цвет стартовой молекулы, иначе она ничего не делает.
+        // Перекрашивание не замеряется, так как в игре оно растянуто на много кадров.
+        // Заливка обходит только область стартовой молекулы, поэтому время делится
+        // на число залитых молекул, а не на число всех молекул.
+        long long fillNSec = 0;
+        double numFilledMolecules = 0.0;
+        for (int i = 0; i < NUM_FILLS; i++)
+        {
+            int start = Random(numMolecules);
+            int color = (containerLogic_->GetMoleculeColor(start) + 1 + Random(NUM_COLORS - 1)) % NUM_COLORS;
+
+            BenchmarkClock::time_point begin = BenchmarkClock::now();
+            containerLogic_->Fill(start, color);
+            fillNSec += ElapsedNSec(begin);
+
+            numFilledMolecules += containerLogic_->GetNumFillingMolecules();
+            containerLogic_->FinishFilling();
+        }
+
+        // Указатель volatile, чтобы компилятор не вынес проверку из цикла.
+        ContainerLogic* volatile logic = containerLogic_;
+        int numSingleColor = 0;
+        BenchmarkClock::time_point begin = BenchmarkClock::now();
+        for (int i = 0; i < NUM_SINGLE_COLOR_CHECKS; i++)
+            numSingleColor += logic->IsSingleColor();
+        long long singleColorNSec = ElapsedNSec(begin);
+
+        // Если все молекулы уснули, то время почти нулевое, и делить его не на что.
+        awakeMoleculeSteps = Max(awakeMoleculeSteps, 1.0);
+
+        JSONValue result;
+        result.Set("molecules", numMolecules);
+        result.Set("mix", mix.name_);
+        result.Set("steps", numSteps);
+        result.Set("forcesNsPerMoleculeStep", forcesNSec / awakeMoleculeSteps);
+        result.Set("integrationNsPerMoleculeStep", positionsNSec / awakeMoleculeSteps);
+        // Среднее число молекул, которые не спали во время замера.
+        result.Set("averageAwakeMolecules", awakeMoleculeSteps / numSteps);
+        result.Set("fillNsPerMolecule", fillNSec / Max(numFilledMolecules, 1.0));
+        // Среднее число молекул, залитых за одну заливку.
+        result.Set("averageFilledMolecules", numFilledMolecules / NUM_FILLS);
+        result.Set("isSingleColorNs", (double)singleColorNSec / NUM_SINGLE_COLOR_CHECKS);
+        result.Set("singleColor", numSingleColor > 0);
+        // Молекулы, которые еще не уснули к концу замера (см. ContainerLogic::UpdateSleeping()).
+        result.Set("awakeMolecules", containerLogic_->GetNumAwakeMolecules());
+        return result;
+    }
+
+    // Считает силы каждой поддерживаемой реализацией из одного и того же состояния
+    // и сравнивает их побитово с силами скалярной реализации.
+    JSONValue VerifyKernels(int numMolecules, const ColorMix& mix)
+    {
+        // Молекулы расталкиваются скалярной реализацией, чтобы исходное состояние
+        // не зависело от проверяемых.
+        containerLogic_->SetForceKernel(FK_SCALAR);
+        PrepareCase(numMolecules, mix);
+
+        LevelData state;
+        containerLogic_->SaveLevelData(state);
+
+        const ForceKernel kernels[] = { FK_SCALAR, FK_SSE, FK_AVX, FK_NEON };
+        PODVector<Vector2> referenceForces(numMolecules);
+        JSONValue kernelResults;
+
+        for (ForceKernel kernel : kernels)
+        {
+            if (!IsForceKernelSupported(kernel))
+                continue;
+
+            // После загрузки все молекулы не спят, поэтому силы считаются для всех.
+            containerLogic_->LoadLevelData(state);
+            containerLogic_->SetRandomSeed(1);
+            containerLogic_->SetForceKernel(kernel);
+            containerLogic_->UpdateForces();
+
+            int numMismatches = 0;
+            for (int i = 0; i < numMolecules; i++)
+            {
+                Vector2 force = containerLogic_->GetMoleculeForce(i);
+
+                if (kernel == FK_SCALAR)
+                    referenceForces[i] = force;
+                else if (memcmp(&force, &referenceForces[i], sizeof(Vector2)) != 0)
+                    numMismatches++;
+            }
+
+            if (numMismatches > 0)
+                exitCode_ = EXIT_FAILURE;
+
+            JSONValue kernelResult;
+            kernelResult.Set("kernel", GetForceKernelName(kernel));
+            kernelResult.Set("mismatches", numMismatches);
+            kernelResults.Push(kernelResult);
+        }
+
+        JSONValue result;
+        result.Set("molecules", numMolecules);
+        result.Set("mix", mix.name_);
+        result.Set("kernels", kernelResults);
+        return result;
+    }
+};
+
+URHO3D_DEFINE_APPLICATION_MAIN(Benchmark)
@@ -11,12 +11,44 @@ String Config::GetConfigFileName()
     return FILE_SYSTEM->GetAppPreferencesDir("1vanK", "PuddleSimulator") + "Config.xml";
 }
 
+String Config::GetLevelPackFileName() const
+{
+    return FILE_SYSTEM->GetProgramDir() + "GameData/Levels.pak";
+}
+
+String Config::GetLevelListFileName() const
+{
+    return FILE_SYSTEM->GetProgramDir() + "GameData/Levels.txt";
+}
+
 void Config::Load()
 {
-    // Загружаем список уровней.
-    SharedPtr<File> file = CACHE->GetFile("Levels.txt");
-    while (!file->IsEof())
-        levelList_.Push(file->ReadLine());
+    // Загружаем список уровней. Если есть архив, то имена берутся из его оглавления,
+    // иначе из GameData/Levels.txt. Архиву доверяем без обращения к отдельным файлам,
+    // иначе запуск снова зависел бы от числа уровней. При разработке уровней параметр
+    // -check-level-pack отключает архив, если список или уровни изменены после его сборки
+    // (например, сохранены в редакторе), чтобы изменения молча не терялись.
+    bool checkLevelPack = GetArguments().Contains("-check-level-pack");
+
+    if (levelPack_.Open(GetLevelPackFileName()) && checkLevelPack && LevelPackIsStale())
+    {
+        URHO3D_LOGWARNING(GetLevelPackFileName() + " does not match the level files and is ignored, rebuild it with P in the editor");
+        levelPack_.Close();
+    }
+
+    if (levelPack_.IsOpen())
+    {
+        URHO3D_LOGINFO("Levels are loaded from " + GetLevelPackFileName() + ", GameData/Levels.txt and GameData/Scenes are ignored");
+
+        for (int i = 0; i < levelPack_.GetNumLevels(); i++)
+            levelList_.Push(levelPack_.GetLevelName(i));
+    }
+    else
+    {
+        SharedPtr<File> file = CACHE->GetFile("Levels.txt");
+        while (!file->IsEof())
+            levelList_.Push(file->ReadLine());
+    }
 
     // Загружаем конфиг.
     String fileName = GetConfigFileName();
@@ -32,6 +64,27 @@ void Config::Load()
     }
 }
 
+bool Config::LevelPackIsStale() const
+{
+    // Время сравнивается на равенство, так как файл могут заменить и более старой версией.
+    // Для отсутствующих файлов время изменения нулевое.
+    if (FILE_SYSTEM->GetLastModifiedTime(GetLevelListFileName()) != levelPack_.GetLevelListTime())
+        return true;
+
+    String scenesDir = FILE_SYSTEM->GetProgramDir() + "GameData/Scenes/";
+
+    for (int i = 0; i < levelPack_.GetNumLevels(); i++)
+    {
+        String xmlFileName = scenesDir + levelPack_.GetLevelName(i);
+
+        if (FILE_SYSTEM->GetLastModifiedTime(xmlFileName) != levelPack_.GetSourceTime(i)
+            || FILE_SYSTEM->GetLastModifiedTime(GetBinaryLevelFileName(xmlFileName)) != levelPack_.GetBinaryTime(i))
+            return true;
+    }
+
+    return false;
+}
+
 void Config::Save()
 {
     XMLFile xmlFile(context_);
@@ -3,7 +3,7 @@
 */
 
 #pragma once
-#include <Urho3D/Urho3DAll.h>
+#include "LevelPack.h"
 
 #define CONFIG GetSubsystem<Config>()
 
@@ -23,13 +23,27 @@ public:
     int GetNumLevels() const { return levelList_.Size(); }
     // Возвращает нужную строку из файла GameData/Levels.txt.
     String GetLevelFileName(int index) const { return levelList_[index]; }
+    // Список строк из GameData/Levels.txt.
+    const Vector<String>& GetLevelList() const { return levelList_; }
+    // Архив уровней GameData/Levels.pak. Если архива нет, то nullptr, и уровни
+    // загружаются из отдельных файлов.
+    const LevelPack* GetLevelPack() const { return levelPack_.IsOpen() ? &levelPack_ : nullptr; }
+    // Путь к архиву уровней.
+    String GetLevelPackFileName() const;
+    // Путь к GameData/Levels.txt.
+    String GetLevelListFileName() const;
 
 private:
     // Список строк из GameData/Levels.txt.
     Vector<String> levelList_;
+    // Если архив уровней есть, то список уровней берется из его оглавления.
+    LevelPack levelPack_;
 
     // Путь для сохранения конфига.
     String GetConfigFileName();
-    // Загружает конфиг и список строк из GameData/Levels.txt.
+    // GameData/Levels.txt или файлы уровней из архива изменены после создания архива.
+    // Обращается к каждому файлу, поэтому вызывается только с параметром -check-level-pack.
+    bool LevelPackIsStale() const;
+    // Загружает конфиг и список уровней.
     void Load();
 };
@@ -1,6 +1,7 @@
 #include "ContainerLogic.h"
 #include "Urho3DAliases.h"
-#include "UIManager.h"
+#include "Global.h"
+#include "FrameProfiler.h"
 
 // Расстояние, на котором молекулы перестают взаимодействовать.
 // Чем больше это расстояние, тем активнее одноцветные молекулы собираются в круглые
@@ -12,8 +13,39 @@
 // слегка вдавленные друг в друга, стянутся в треугольник (то есть две крайние молекулы
 // ряда взаимодействуют).
 static const float INTERACTION_RANGE = MOLECULE_RADIUS * 4.0f;
-// Задержка перед изменением цвета очередных пяти молекул при заливке.
-static const float FILLING_DELAY = 0.02f;
+// Множитель силы отталкивания. Сила считается по кубическому закону: на больших
+// расстояниях отталкивание мало, но при сближении молекул резко (нелинейно) возрастает.
+// Вдавленные друг в друга молекулы будут отталкиваться очень сильно.
+static const float REPULSION_STRENGTH = 50.0f;
+// Молекулы разного типа отталкиваются сильнее, они хотят держаться друг от друга дальше.
+static const float MISMATCH_FACTOR = 2.0f;
+// Вязкость (внутреннее трение жидкости): за секунду скорость молекул уменьшается
+// в exp(VISCOSITY) раз независимо от длины шага физики.
+static const float VISCOSITY = 0.5f;
+// Максимальное перемещение молекулы за один шаг физики. Жесткие силы при длинном шаге
+// могут разогнать молекулу так, что она пролетит сквозь соседей или стенку.
+static const float MAX_STEP_DISPLACEMENT = MOLECULE_RADIUS * 0.5f;
+// Запас дистанции в списках соседей. Чем он больше, тем реже перестраиваются списки,
+// но тем больше в них лишних соседей, которые проверяются при каждом расчете сил.
+static const float NEIGHBOR_SKIN = MOLECULE_RADIUS;
+// Минимальное число молекул, при котором расчет физики распределяется по потокам.
+// Для маленьких луж накладные расходы на запуск задач больше выигрыша.
+static const int PARALLEL_MIN_MOLECULES = 1000;
+// Число задач на поток. Строки сетки в центре круглой ёмкости заполнены плотнее,
+// поэтому мелкие задачи распределяются по потокам равномернее.
+static const int TASKS_PER_THREAD = 4;
+// Молекула покоится, если ее скорость и действующая на нее сила меньше этих значений.
+// Из-за вязкости скорость молекул убывает медленно и никогда не становится нулевой,
+// поэтому без усыпления физика уже неподвижной лужи считается бесконечно.
+static const float SLEEP_SPEED = 0.05f;
+static const float SLEEP_FORCE = 0.25f;
+// Сколько молекула должна покоиться, чтобы уснуть. Проверка одного шага не подходит:
+// в крайних точках колебаний скорость молекулы тоже почти нулевая.
+static const float SLEEP_DELAY = 0.5f;
+// Состояния ячеек в UpdateSleeping().
+static const unsigned char CELL_ASLEEP = 0;
+static const unsigned char CELL_AWAKE = 1;
+static const unsigned char CELL_UNVISITED = 2;
 
 // Имена файлов материалов молекул.
 const char* colorFiles[] = {
@@ -27,8 +59,12 @@ const char* colorFiles[] = {
 };
 
 ContainerLogic::ContainerLogic(Context* context) :
-    Component(context)
+    Component(context),
+    forceKernel_(GetBestForceKernel())
 {
+    for (int i = 0; i < NUM_COLORS; i++)
+        colorMaterials_[i] = GET_MATERIAL(colorFiles[i]);
+
     SubscribeToEvent(E_UPDATE, URHO3D_HANDLER(ContainerLogic, HandleUpdate));
 }
 
@@ -38,124 +74,511 @@ void ContainerLogic::RegisterObject(Context* context)
 
     // Остаток ходов сохраняется в файл сцены.
     URHO3D_ATTRIBUTE("Turns", int, turnsRemain_, DEFAULT_TURNS_REMAIN, AM_FILE);
+    // Форма ёмкости тоже. У круглых ёмкостей атрибут пустой и не сохраняется.
+    URHO3D_MIXED_ACCESSOR_ATTRIBUTE("Shape", GetShapeAttr, SetShapeAttr, String, String::EMPTY, AM_FILE);
+}
+
+const char* GetIntegratorName(PhysicsIntegrator integrator)
+{
+    return integrator == PI_VELOCITY_VERLET ? "Verlet" : "Euler";
+}
+
+bool GetIntegratorByName(const char* name, PhysicsIntegrator& integrator)
+{
+    if (String::Compare(name, "Euler", false) == 0)
+        integrator = PI_SEMI_IMPLICIT_EULER;
+    else if (String::Compare(name, "Verlet", false) == 0)
+        integrator = PI_VELOCITY_VERLET;
+    else
+        return false;
+
+    return true;
+}
+
+void ContainerLogic::SetIntegrator(PhysicsIntegrator integrator)
+{
+    integrator_ = integrator;
+
+    // Силы предыдущего шага могли не сохраняться.
+    for (unsigned i = 0; i < prevForceX_.Size(); i++)
+        prevForceX_[i] = prevForceY_[i] = 0.0f;
+}
+
+void ContainerLogic::SetForceKernel(ForceKernel kernel)
+{
+    if (!IsForceKernelSupported(kernel))
+    {
+        URHO3D_LOGWARNINGF("Force kernel %s is not supported, using scalar", GetForceKernelName(kernel));
+        kernel = FK_SCALAR;
+    }
+
+    forceKernel_ = kernel;
+}
+
+void ContainerLogic::OnNodeSet(Node* node)
+{
+    if (!node)
+        return;
+
+    // Все молекулы рисуются одним компонентом. Он создается заново при каждом создании
+    // ёмкости и не сохраняется в файл сцены.
+    moleculeGroup_ = node->CreateComponent<MoleculeGroup>(LOCAL);
+    moleculeGroup_->SetTemporary(true);
+    moleculeGroup_->SetModel(GET_MODEL("Models/Molecule.mdl"));
+
+    for (int i = 0; i < NUM_COLORS; i++)
+        moleculeGroup_->SetColorMaterial(i, colorMaterials_[i]);
+}
+
+int ContainerLogic::CreateMolecule(const Vector3& pos, int color)
+{
+    AddMolecule(pos, Vector3::ZERO, color);
+    return GetNumMolecules() - 1;
+}
+
+void ContainerLogic::AddMolecule(const Vector3& pos, const Vector3& speed, int color)
+{
+    posX_.Push(pos.x_);
+    posY_.Push(pos.y_);
+    prevPosX_.Push(pos.x_);
+    prevPosY_.Push(pos.y_);
+    speedX_.Push(speed.x_);
+    speedY_.Push(speed.y_);
+    forceX_.Push(0.0f);
+    forceY_.Push(0.0f);
+    prevForceX_.Push(0.0f);
+    prevForceY_.Push(0.0f);
+    colors_.Push(color);
+    restTimes_.Push(0.0f);
+    IncrementColorCount(color);
+    queryGridDirty_ = true;
+    neighborListsDirty_ = true;
+    allAsleep_ = false;
+    moleculeGroupDirty_ = true;
+}
+
+void ContainerLogic::WakeMolecule(int index)
+{
+    restTimes_[index] = 0.0f;
+    allAsleep_ = false;
+}
+
+void ContainerLogic::WakeAll()
+{
+    for (unsigned i = 0; i < restTimes_.Size(); i++)
+        restTimes_[i] = 0.0f;
+
+    allAsleep_ = false;
+}
+
+Node* ContainerLogic::GetBottomNode() const
+{
+    if (bottomNode_.Expired())
+    {
+        Scene* scene = GetScene();
+        bottomNode_ = scene ? scene->GetChild("ContainerBottom") : nullptr;
+    }
+
+    return bottomNode_;
+}
+
+void ContainerLogic::SetShape(const PODVector<Vector2>& vertices)
+{
+    shape_.SetVertices(vertices);
+    // Стенки сдвинулись.
+    WakeAll();
+    UpdateBottomGeometry();
+}
+
+void ContainerLogic::SetShapeAttr(const String& value)
+{
+    PODVector<Vector2> vertices;
+    ContainerShape::ParseVertices(value, vertices);
+    SetShape(vertices);
+}
+
+void ContainerLogic::UpdateBottomGeometry()
+{
+    // Сцены без графики (PuddleBatch, PuddleBenchmark) дно не рисуют.
+    Node* bottomNode = GetBottomNode();
+    StaticModel* bottomModel = bottomNode ? bottomNode->GetComponent<StaticModel>() : nullptr;
+    if (!bottomModel)
+        return;
+
+    CustomGeometry* bottomGeometry = bottomNode->GetComponent<CustomGeometry>();
+    const PODVector<Vector2>& vertices = shape_.GetVertices();
+
+    if (shape_.IsCircle())
+    {
+        bottomModel->SetEnabled(true);
+        if (bottomGeometry)
+            bottomGeometry->SetEnabled(false);
+        return;
+    }
+
+    // Геометрия строится по форме и не сохраняется в файл сцены.
+    if (!bottomGeometry)
+    {
+        bottomGeometry = bottomNode->CreateComponent<CustomGeometry>(LOCAL);
+        bottomGeometry->SetTemporary(true);
+    }
+
+    bottomModel->SetEnabled(false);
+    bottomGeometry->SetEnabled(true);
+    bottomGeometry->BeginGeometry(0, TRIANGLE_LIST);
+
+    // Вершины треугольников идут против часовой стрелки, а лицевые грани в движке -
+    // по часовой, поэтому вершины каждого треугольника перечисляются в обратном порядке.
+    // Масштаб дна равен радиусу ёмкости, поэтому вершины берутся как есть.
+    PODVector<int> indices;
+    shape_.Triangulate(indices);
+
+    for (unsigned i = 0; i + 2 < indices.Size(); i += 3)
+    {
+        for (int corner = 2; corner >= 0; corner--)
+        {
+            const Vector2& vertex = vertices[indices[i + corner]];
+            bottomGeometry->DefineVertex(Vector3(vertex.x_, vertex.y_, 0.0f));
+            bottomGeometry->DefineNormal(Vector3::BACK);
+        }
+    }
+
+    bottomGeometry->Commit();
+    bottomGeometry->SetMaterial(bottomModel->GetMaterial());
+}
+
+void ContainerLogic::IncrementColorCount(int color)
+{
+    if (colorCounts_[color]++ == 0)
+        numRemainingColors_++;
+}
+
+void ContainerLogic::DecrementColorCount(int color)
+{
+    if (--colorCounts_[color] == 0)
+        numRemainingColors_--;
+}
+
+void ContainerLogic::WriteMoleculesToNodes()
+{
+    RemoveMoleculeNodes();
+
+    for (int i = 0; i < GetNumMolecules(); i++)
+    {
+        Node* molecule = node_->CreateChild();
+        molecule->SetPosition(Vector3(posX_[i], posY_[i], 0.0f));
+        molecule->SetVar("Color", colors_[i]);
+        molecule->SetVar("Speed", Vector3(speedX_[i], speedY_[i], 0.0f));
+
+        // Модель сохраняется для совместимости со старыми уровнями, чтобы файл
+        // можно было открыть в редакторе движка.
+        StaticModel* object = molecule->CreateComponent<StaticModel>();
+        object->SetModel(GET_MODEL("Models/Molecule.mdl"));
+        object->SetMaterial(colorMaterials_[colors_[i]]);
+    }
+}
+
+void ContainerLogic::RemoveMoleculeNodes()
+{
+    node_->RemoveAllChildren();
+}
+
+void ContainerLogic::LoadLevelData(const LevelData& level)
+{
+    turnsRemain_ = level.turns_;
+
+    // Поле расстояний пересчитывается, только если форма изменилась (при перезапуске
+    // уровня форма обычно та же).
+    if (level.containerShape_ != shape_.GetVertices())
+        SetShape(level.containerShape_);
+
+    // Сбрасываем состояние, которое не хранится в уровне.
+    for (int i = 0; i < NUM_COLORS; i++)
+        colorCounts_[i] = 0;
+    numRemainingColors_ = 0;
+    fillingHead_ = fillingTail_ = 0;
+    physicsAccumulator_ = 0.0f;
+    stepIndex_ = 0;
+
+    int numMolecules = level.GetNumMolecules();
+    posX_ = level.posX_;
+    posY_ = level.posY_;
+    prevPosX_ = level.posX_;
+    prevPosY_ = level.posY_;
+    speedX_ = level.speedX_;
+    speedY_ = level.speedY_;
+    forceX_.Resize(numMolecules);
+    forceY_.Resize(numMolecules);
+    prevForceX_.Resize(numMolecules);
+    prevForceY_.Resize(numMolecules);
+    colors_.Resize(numMolecules);
+    restTimes_.Resize(numMolecules);
+
+    for (int i = 0; i < numMolecules; i++)
+    {
+        forceX_[i] = forceY_[i] = prevForceX_[i] = prevForceY_[i] = 0.0f;
+        colors_[i] = level.colors_[i];
+        IncrementColorCount(colors_[i]);
+    }
+
+    // Состояние сна не хранится в уровне, поэтому после загрузки все молекулы не спят.
+    WakeAll();
+    queryGridDirty_ = true;
+    neighborListsDirty_ = true;
+    moleculeGroupDirty_ = true;
+}
+
+void ContainerLogic::RestoreSnapshot()
+{
+    FRAME_PROFILE(RestoreSnapshot);
+
+    GetBottomNode()->SetScale(snapshot_.containerRadius_);
+
+    // Размеры массивов не меняются, поэтому память не выделяется.
+    LoadLevelData(snapshot_);
+}
+
+void ContainerLogic::SaveLevelData(LevelData& level) const
+{
+    level.containerRadius_ = GetRadius();
+    level.containerShape_ = shape_.GetVertices();
+    level.turns_ = turnsRemain_;
+
+    int numMolecules = GetNumMolecules();
+    level.posX_ = posX_;
+    level.posY_ = posY_;
+    level.speedX_ = speedX_;
+    level.speedY_ = speedY_;
+    level.colors_.Resize(numMolecules);
+
+    for (int i = 0; i < numMolecules; i++)
+        level.colors_[i] = (unsigned char)colors_[i];
+}
+
+void ContainerLogic::SetMoleculeColor(int index, int color)
+{
+    DecrementColorCount(colors_[index]);
+    IncrementColorCount(color);
+    colors_[index] = color;
+    // Силы отталкивания зависят от цвета соседей.
+    WakeMolecule(index);
+    moleculeGroupDirty_ = true;
+}
+
+void ContainerLogic::UpdateQueryGrid()
+{
+    if (!queryGridDirty_)
+        return;
+
+    // Сетка покрывает ёмкость с запасом, вылетевшие молекулы попадут в крайние ячейки.
+    float gridExtent = GetRadius() + FILL_NEIGHBOR_DISTANCE;
+    queryGrid_.Build(posX_.Buffer(), posY_.Buffer(), GetNumMolecules(), FILL_NEIGHBOR_DISTANCE,
+        -gridExtent, -gridExtent, gridExtent, gridExtent);
+
+    queryGridDirty_ = false;
 }
 
-void ContainerLogic::SetMoleculeColor(Node* molecule, int color)
+int ContainerLogic::GetMoleculeAt(const Vector3& point)
 {
-    // Номер цвета сохраняется в переменную ноды.
-    molecule->SetVar("Color", color);
+    UpdateQueryGrid();
 
-    // Меняем материал модели.
-    StaticModel* staticModel = molecule->GetComponent<StaticModel>();
-    staticModel->SetMaterial(GET_MATERIAL(colorFiles[color]));
+    // Ячейка больше радиуса молекулы, поэтому достаточно проверить соседние ячейки.
+    int cellX = queryGrid_.GetCellX(point.x_);
+    int cellY = queryGrid_.GetCellY(point.y_);
+    int result = -1;
+    float minDistance = MOLECULE_RADIUS * MOLECULE_RADIUS;
+
+    for (int y = Max(cellY - 1, 0); y <= Min(cellY + 1, queryGrid_.GetHeight() - 1); y++)
+    {
+        for (int x = Max(cellX - 1, 0); x <= Min(cellX + 1, queryGrid_.GetWidth() - 1); x++)
+        {
+            int cell = queryGrid_.GetCellIndex(x, y);
+            const int* cellEnd = queryGrid_.GetCellEnd(cell);
+
+            for (const int* i = queryGrid_.GetCellBegin(cell); i != cellEnd; ++i)
+            {
+                float dx = posX_[*i] - point.x_;
+                float dy = posY_[*i] - point.y_;
+                float distance = dx * dx + dy * dy;
+
+                if (distance <= minDistance)
+                {
+                    minDistance = distance;
+                    result = *i;
+                }
+            }
+        }
+    }
+
+    return result;
+}
+
+void ContainerLogic::GetMoleculesInRadius(const Vector3& center, float radius, PODVector<int>& result)
+{
+    UpdateQueryGrid();
+
+    // Круги пересекаются, если центр молекулы ближе суммы радиусов.
+    float maxDistance = radius + MOLECULE_RADIUS;
+    int minCellX = queryGrid_.GetCellX(center.x_ - maxDistance);
+    int maxCellX = queryGrid_.GetCellX(center.x_ + maxDistance);
+    int minCellY = queryGrid_.GetCellY(center.y_ - maxDistance);
+    int maxCellY = queryGrid_.GetCellY(center.y_ + maxDistance);
+
+    for (int y = minCellY; y <= maxCellY; y++)
+    {
+        for (int x = minCellX; x <= maxCellX; x++)
+        {
+            int cell = queryGrid_.GetCellIndex(x, y);
+            const int* cellEnd = queryGrid_.GetCellEnd(cell);
+
+            for (const int* i = queryGrid_.GetCellBegin(cell); i != cellEnd; ++i)
+            {
+                float dx = posX_[*i] - center.x_;
+                float dy = posY_[*i] - center.y_;
+
+                if (dx * dx + dy * dy <= maxDistance * maxDistance)
+                    result.Push(*i);
+            }
+        }
+    }
 }
 
 void ContainerLogic::UpdateFilling(float timeStep)
 {
+    FRAME_PROFILE(UpdateFilling);
+
     if (fillingDelay_ > 0.0f)
         fillingDelay_ -= timeStep;
 
     if (fillingDelay_ <= 0.0f)
     {
-        // Меняем цвет пяти молекул за раз.
-        for (int i = 0; i < 5 && filledMolecules_.Size() > 0; i++)
+        // Меняем цвет нескольких молекул за раз.
+        for (int i = 0; i < fillingMoleculesPerStep_ && FillingIsDoing(); i++)
         {
-            // Забираем первую молекулу из списка.
-            Node* molecule = filledMolecules_.Front();
-            filledMolecules_.Erase(0, 1);
-
-            // Меняем ее цвет.
-            SetMoleculeColor(molecule, UI_MANAGER->selectedColor_);
+            // Забираем первую молекулу из очереди и меняем ее цвет.
+            int molecule = fillQueue_[fillingHead_++];
+            SetMoleculeColor(molecule, fillingColor_);
         }
 
         // Снова устанавливаем задержку.
-        fillingDelay_ = FILLING_DELAY;
+        fillingDelay_ = fillingStepDelay_;
+    }
+}
+
+void ContainerLogic::FinishFilling()
+{
+    while (FillingIsDoing())
+    {
+        int molecule = fillQueue_[fillingHead_++];
+        SetMoleculeColor(molecule, fillingColor_);
     }
 }
 
-void ContainerLogic::Fill(Node* startMolecule)
+bool ContainerLogic::Fill(int startIndex, int color)
 {
+    FRAME_PROFILE(Fill);
+
+    // Предыдущая заливка не закончилась. Завершаем ее сразу, так как очередь будет перезаписана.
+    // Это нужно сделать до проверки цвета: стартовая молекула может быть еще в очереди.
+    FinishFilling();
+
     // Цвет стартовой молекулы.
-    int startColor = GetMoleculeColor(startMolecule);
+    int startColor = GetMoleculeColor(startIndex);
 
     // Стартовая молекула уже нужного цвета.
-    if (startColor == UI_MANAGER->selectedColor_)
-        return;
+    if (startColor == color)
+        return false;
 
-    GLOBAL->PlaySound("Fill", "Sounds/Fill", 3);
+    if (recording_)
+    {
+        ReplayFill fill;
+        fill.step_ = stepIndex_;
+        fill.molecule_ = startIndex;
+        fill.color_ = color;
+        replay_.fills_.Push(fill);
+    }
+
+    fillingColor_ = color;
 
     turnsRemain_--;
 
-    auto molecules = node_->GetChildren();
+    int numMolecules = GetNumMolecules();
+
+    // Ячейки сетки размером с дистанцию соседства. Тогда соседи
+    // молекулы находятся в ее ячейке и восьми соседних.
+    UpdateQueryGrid();
 
-    // Очищаем все молекулы от служебного тега.
-    for (Node* molecule : molecules)
-        molecule->RemoveTag("Checked");
+    // Очищаем отметки о проверке.
+    fillVisited_.Resize((numMolecules + 31) / 32);
+    for (unsigned i = 0; i < fillVisited_.Size(); i++)
+        fillVisited_[i] = 0;
 
-    // Список молекул, для которых нужно проверить их соседей (ищутся соседи
+    // Очередь молекул, для которых нужно проверить их соседей (ищутся соседи
     // с таким же цветом). Но сами эти молекулы уже проверены.
-    PODVector<Node*> needChekNeighbors;
+    fillQueue_.Resize(numMolecules);
+    int queueHead = 0;
+    int queueTail = 0;
 
     // Стартовая молекула уже проверена.
-    startMolecule->AddTag("Checked");
+    fillVisited_[startIndex >> 5] |= 1u << (startIndex & 31);
     // Но нужно проверить ее соседей.
-    needChekNeighbors.Push(startMolecule);
-    // А также ее цвет будет изменен.
-    filledMolecules_.Push(startMolecule);
+    fillQueue_[queueTail++] = startIndex;
 
-    // Выполняем, пока в списке есть молекулы.
-    while (needChekNeighbors.Size() > 0)
+    // Выполняем, пока в очереди есть молекулы.
+    while (queueHead < queueTail)
     {
-        // Забираем первую молекулу из списка. Порядок важен, чтобы
+        // Забираем первую молекулу из очереди. Порядок важен, чтобы
         // заливка при анимации распространялась от стартовой молекулы.
-        Node* molecule = needChekNeighbors.Front();
-        needChekNeighbors.Erase(0, 1);
+        int molecule = fillQueue_[queueHead++];
+
+        // Собираем непроверенные молекулы из соседних ячеек.
+        int cellX = queryGrid_.GetCellX(posX_[molecule]);
+        int cellY = queryGrid_.GetCellY(posY_[molecule]);
+        fillCandidates_.Clear();
 
-        // Находим всех соседей рассматриваемой моекулы.
-        for (Node* anotherMolecule : molecules)
+        for (int y = Max(cellY - 1, 0); y <= Min(cellY + 1, queryGrid_.GetHeight() - 1); y++)
         {
-            // Уже проверенные молекулы пропускаем.
-            if (anotherMolecule->HasTag("Checked"))
-                continue;
+            for (int x = Max(cellX - 1, 0); x <= Min(cellX + 1, queryGrid_.GetWidth() - 1); x++)
+            {
+                int cell = queryGrid_.GetCellIndex(x, y);
+                const int* cellEnd = queryGrid_.GetCellEnd(cell);
 
+                for (const int* j = queryGrid_.GetCellBegin(cell); j != cellEnd; ++j)
+                {
+                    if (!(fillVisited_[*j >> 5] & (1u << (*j & 31))))
+                        fillCandidates_.Push(*j);
+                }
+            }
+        }
+
+        // Соседи должны попадать в очередь по возрастанию индекса (как при переборе
+        // всех молекул), иначе изменится порядок анимации заливки.
+        Sort(fillCandidates_.Begin(), fillCandidates_.End());
+
+        for (int anotherMolecule : fillCandidates_)
+        {
             // Если дистанция между молекулами слишком большая, то они не соседние.
-            float distance = (molecule->GetPosition() - anotherMolecule->GetPosition()).Length();
-            if (distance > MOLECULE_RADIUS * 2.2f)
+            float dx = posX_[molecule] - posX_[anotherMolecule];
+            float dy = posY_[molecule] - posY_[anotherMolecule];
+            float distance = sqrtf(dx * dx + dy * dy);
+            if (distance > FILL_NEIGHBOR_DISTANCE)
                 continue;
 
             // Если у соседа цвет стартовой молекулы, то заливка распространяется дальше.
-            // Меняем цвет молекулы и помещаем ее в список для проверки ее соседей.
+            // Меняем цвет молекулы и помещаем ее в очередь для проверки ее соседей.
             if (GetMoleculeColor(anotherMolecule) == startColor)
             {
-                anotherMolecule->AddTag("Checked");
-                needChekNeighbors.Push(anotherMolecule);
-                filledMolecules_.Push(anotherMolecule);
+                fillVisited_[anotherMolecule >> 5] |= 1u << (anotherMolecule & 31);
+                fillQueue_[queueTail++] = anotherMolecule;
             }
         }
     }
 
-    // Подготавливаемся к вызову UpdateFilling(). Первые 5 молекул
-    // изменят цвет без задержки.
+    // Подготавливаемся к вызову UpdateFilling(). Все молекулы из очереди
+    // (включая стартовую) изменят цвет. Первые из них изменят цвет без задержки.
+    fillingHead_ = 0;
+    fillingTail_ = queueTail;
     fillingDelay_ = 0.0f;
-}
-
-bool ContainerLogic::IsSingleColor()
-{
-    auto molecules = node_->GetChildren();
-
-    // Ёмкость пуста.
-    if (molecules.Size() == 0)
-        return true;
-
-    // Цвет первой молекулы.
-    int firstColor = GetMoleculeColor(molecules[0]);
-
-    for (int i = 1; i < (int)molecules.Size(); i++)
-    {
-        // Найдена молекула с другим цветом.
-        if (GetMoleculeColor(molecules[i]) != firstColor)
-            return false;
-    }
 
     return true;
 }
@@ -164,140 +587,654 @@ void ContainerLogic::HandleUpdate(StringHash eventType, VariantMap& eventData)
 {
     float timeStep = eventData[Update::P_TIMESTEP].GetFloat();
 
-    UpdateMolecules(timeStep);
+    UpdatePhysics(timeStep);
 
     if (GLOBAL->gameState_ != GS_PLAY)
         return;
 
-    // Если в данный момент производится заливка, то анимируем ее.
+    // Заливка анимируется в шагах физики. Пока она не закончилась, исход не проверяем.
     if (FillingIsDoing())
-    {
-        UpdateFilling(timeStep);
         return;
+
+    bool singleColor;
+    {
+        FRAME_PROFILE(IsSingleColor);
+        singleColor = IsSingleColor();
     }
 
     // Игрок выигрывает, если все молекулы одинакового цвета.
-    if (IsSingleColor())
+    if (singleColor)
         GLOBAL->neededGameState_ = GS_WIN;
     // Игрок проигрывает, если есть молекулы разного цвета и больше нет ходов.
     else if (turnsRemain_ == 0)
         GLOBAL->neededGameState_ = GS_GAME_OVER;
 }
 
-void ContainerLogic::UpdateMolecules(float timeStep)
+void ContainerLogic::UpdatePhysics(float timeStep)
 {
-    auto molecules = node_->GetChildren();
+    physicsAccumulator_ += timeStep;
+
+    // Число шагов, которые нужно сделать в этом кадре.
+    int numSteps = (int)(physicsAccumulator_ / physicsStep_);
+
+    if (numSteps > maxPhysicsSubsteps_)
+    {
+        // Кадр был слишком долгим (например, из-за загрузки уровня). Лишнее время
+        // отбрасываем, иначе огромный шаг выбросит молекулы за стенки ёмкости,
+        // а большое число шагов приведет к еще более долгому следующему кадру.
+        numSteps = maxPhysicsSubsteps_;
+        physicsAccumulator_ = numSteps * physicsStep_;
+    }
+
+    StepPhysics(numSteps);
+    physicsAccumulator_ -= numSteps * physicsStep_;
+
+    // Если все молекулы спят, то трансформации не меняются.
+    if (moleculeGroupDirty_)
+    {
+        UpdateMoleculeGroup(Clamp(physicsAccumulator_ / physicsStep_, 0.0f, 1.0f));
+        moleculeGroupDirty_ = !allAsleep_;
+    }
+}
+
+void ContainerLogic::UpdateWalls()
+{
+    float containerRadius = GetRadius();
 
-    // Обнуляем силы, действующие на молекулы.
-    for (unsigned i = 0; i < molecules.Size(); i++)
-        molecules[i]->SetVar("Force", Vector3::ZERO);
+    // Стенки сдвинулись (размер ёмкости меняется в редакторе).
+    if (containerRadius != wallRadius_)
+    {
+        wallRadius_ = containerRadius;
+        // Поле расстояний рассчитано в масштабе ёмкости и не пересчитывается.
+        shape_.SetScale(containerRadius);
+        WakeAll();
+    }
+}
 
-    // Вычисляем воздействия молекул друг на друга.
-    for (Node* molecule : molecules)
+void ContainerLogic::StepPhysics(int numSteps)
+{
+    // Проверяется до шагов, так как шаги спящей лужи ничего не делают, и она
+    // не проснулась бы при изменении размера ёмкости.
+    UpdateWalls();
+
+    for (int step = 0; step < numSteps; step++)
     {
-        for (Node* anotherMolecule : molecules)
+        // Для интерполяции нужны только позиции перед последним шагом.
+        if (step == numSteps - 1)
         {
-            // Сама с собой молекула не взаимодействует.
-            if (molecule == anotherMolecule)
-                continue;
+            prevPosX_ = posX_;
+            prevPosY_ = posY_;
+        }
+
+        // Заливка анимируется с шагом физики, а не кадра, чтобы смена цветов
+        // происходила на тех же шагах при воспроизведении записи.
+        if (FillingIsDoing())
+            UpdateFilling(physicsStep_);
+
+        // Спящие молекулы не двигаются.
+        if (!allAsleep_)
+        {
+            UpdateMolecules(physicsStep_);
+            queryGridDirty_ = true;
+            moleculeGroupDirty_ = true;
+        }
+
+        stepIndex_++;
+    }
+}
+
+float ContainerLogic::PhysicsRandom(float min, float max)
+{
+    // Тот же линейный конгруэнтный генератор, что и Rand() в движке.
+    randomSeed_ = randomSeed_ * 214013 + 2531011;
+    return ((randomSeed_ >> 16) & 32767) * (max - min) / 32767.0f + min;
+}
+
+void ContainerLogic::StartRecording()
+{
+    // Запись начинается с нулевого шага, номера шагов заливок отсчитываются от него.
+    stepIndex_ = 0;
+    // При воспроизведении молекулы загружаются неспящими, поэтому будим их и здесь.
+    WakeAll();
+    replay_.seed_ = randomSeed_;
+    replay_.physicsRate_ = (int)(1.0f / physicsStep_ + 0.5f);
+    replay_.integrator_ = integrator_;
+    SaveLevelData(replay_.level_);
+    replay_.fills_.Clear();
+    recording_ = true;
+}
+
+const Replay& ContainerLogic::FinishRecording()
+{
+    LevelData finalState;
+    SaveLevelData(finalState);
+    replay_.numSteps_ = stepIndex_;
+    replay_.finalHash_ = HashLevelData(finalState);
+    recording_ = false;
+    return replay_;
+}
+
+bool ContainerLogic::PlayReplay(const Replay& replay)
+{
+    GetBottomNode()->SetScale(replay.level_.containerRadius_);
+    SetPhysicsRate(replay.physicsRate_);
+    SetIntegrator((PhysicsIntegrator)replay.integrator_);
+    LoadLevelData(replay.level_);
+    randomSeed_ = replay.seed_;
+    recording_ = false;
+
+    for (const ReplayFill& fill : replay.fills_)
+    {
+        StepPhysics(fill.step_ - stepIndex_);
+        Fill(fill.molecule_, fill.color_);
+    }
+
+    StepPhysics(replay.numSteps_ - stepIndex_);
+
+    LevelData finalState;
+    SaveLevelData(finalState);
+    return HashLevelData(finalState) == replay.finalHash_;
+}
+
+NeighborBatch ContainerLogic::GatherNeighbors(int slot, PhysicsTask& task) const
+{
+    task.neighborX_.Clear();
+    task.neighborY_.Clear();
+    task.neighborColor_.Clear();
+    task.neighborId_.Clear();
+
+    for (int k = neighborStart_[slot]; k < neighborStart_[slot + 1]; k++)
+    {
+        int j = neighborIndices_[k];
+        task.neighborX_.Push(posX_[j]);
+        task.neighborY_.Push(posY_[j]);
+        task.neighborColor_.Push((float)colors_[j]);
+        task.neighborId_.Push((float)j);
+    }
+
+    // Дополняем массивы далекими точками, которые ни с чем не взаимодействуют.
+    while (task.neighborX_.Size() % FORCE_KERNEL_WIDTH != 0)
+    {
+        task.neighborX_.Push(M_LARGE_VALUE);
+        task.neighborY_.Push(M_LARGE_VALUE);
+        task.neighborColor_.Push(-1.0f);
+        task.neighborId_.Push(-1.0f);
+    }
+
+    NeighborBatch batch;
+    batch.x_ = task.neighborX_.Buffer();
+    batch.y_ = task.neighborY_.Buffer();
+    batch.color_ = task.neighborColor_.Buffer();
+    batch.id_ = task.neighborId_.Buffer();
+    batch.size_ = task.neighborX_.Size();
+    return batch;
+}
+
+void ContainerLogic::CalculateForces(PhysicsTask& task)
+{
+    RepulsionParams params;
+    params.range_ = INTERACTION_RANGE;
+    params.strength_ = REPULSION_STRENGTH;
+    params.mismatchFactor_ = MISMATCH_FACTOR;
+
+    task.coincident_.Clear();
+    const int* slotMolecules = grid_.GetPoints();
+
+    // Каждая молекула получает силу только от соседей и сама ее записывает, поэтому
+    // силы не нужно обнулять, а разные задачи не пишут в одни и те же элементы.
+    for (int slot = task.begin_; slot < task.end_; slot++)
+    {
+        int i = slotMolecules[slot];
 
-            Vector3 moleculePos = molecule->GetPosition();
-            Vector3 anotherMoleculePos = anotherMolecule->GetPosition();
+        // Соседи молекулы входят в тот же остров, поэтому спящая молекула ни с кем не взаимодействует.
+        if (!awake_[i])
+            continue;
 
-            // Расстояние между молекулами.
-            float distance = (moleculePos - anotherMoleculePos).Length();
+        NeighborBatch neighbors = GatherNeighbors(slot, task);
 
-            if (Equals(distance, 0.0f))
+        bool coincident = ComputeRepulsion(forceKernel_, params, posX_[i], posY_[i],
+            (float)colors_[i], (float)i, neighbors, forceX_[i], forceY_[i]);
+
+        if (coincident)
+            task.coincident_.Push(i);
+    }
+}
+
+void ContainerLogic::SeparateCoincident(int index)
+{
+    int slot = moleculeSlots_[index];
+
+    for (int k = neighborStart_[slot]; k < neighborStart_[slot + 1]; k++)
+    {
+        int j = neighborIndices_[k];
+
+        // Каждую пару обрабатываем один раз (со стороны молекулы с меньшим индексом).
+        if (j <= index)
+            continue;
+
+        float dx = posX_[j] - posX_[index];
+        float dy = posY_[j] - posY_[index];
+
+        if (!Equals(sqrtf(dx * dx + dy * dy), 0.0f))
+            continue;
+
+        // Случилось страшное - молекулы находятся в одной точке.
+        // Задаем им противоположные скорости.
+        // Вероятность, что скорости по обеим осям будут нулевыми, крайне мала.
+        // В любом случае, в следующий раз снова будет произведена попытка
+        // разлепить молекулы.
+        float speedX = PhysicsRandom(-2.0f, 2.0f);
+        float speedY = PhysicsRandom(-2.0f, 2.0f);
+        speedX_[index] = speedX;
+        speedY_[index] = speedY;
+        speedX_[j] = -speedX;
+        speedY_[j] = -speedY;
+    }
+}
+
+void ContainerLogic::BuildNeighborList(PhysicsTask& task) const
+{
+    float cutoff = INTERACTION_RANGE + NEIGHBOR_SKIN;
+    task.neighborList_.Clear();
+    task.neighborCounts_.Clear();
+
+    // Ячейки сетки размером с дистанцию списков, поэтому соседи молекулы находятся
+    // в ее ячейке и восьми соседних.
+    for (int cellY = task.begin_; cellY < task.end_; cellY++)
+    {
+        for (int cellX = 0; cellX < grid_.GetWidth(); cellX++)
+        {
+            int cell = grid_.GetCellIndex(cellX, cellY);
+            const int* cellEnd = grid_.GetCellEnd(cell);
+
+            for (const int* i = grid_.GetCellBegin(cell); i != cellEnd; ++i)
             {
-                // Случилось страшное - молекулы находятся в одной точке.
-                // Задаем им противоположные скорости.
-                // Вероятность, что скорости по обеим осям будут нулевыми, крайне мала.
-                // В любом случае, в следующий раз снова будет произведена попытка
-                // разлепить молекулы.
-                Vector3 speed = Vector3(Random(-2.0f, 2.0f), Random(-2.0f, 2.0f), 0.0f);
-                molecule->SetVar("Speed", speed);
-                anotherMolecule->SetVar("Speed", -speed);
-                continue;
+                unsigned listBegin = task.neighborList_.Size();
+
+                for (int y = Max(cellY - 1, 0); y <= Min(cellY + 1, grid_.GetHeight() - 1); y++)
+                {
+                    for (int x = Max(cellX - 1, 0); x <= Min(cellX + 1, grid_.GetWidth() - 1); x++)
+                    {
+                        int neighborCell = grid_.GetCellIndex(x, y);
+                        const int* neighborCellEnd = grid_.GetCellEnd(neighborCell);
+
+                        for (const int* j = grid_.GetCellBegin(neighborCell); j != neighborCellEnd; ++j)
+                        {
+                            if (*j == *i)
+                                continue;
+
+                            float dx = posX_[*j] - posX_[*i];
+                            float dy = posY_[*j] - posY_[*i];
+
+                            if (dx * dx + dy * dy <= cutoff * cutoff)
+                                task.neighborList_.Push(*j);
+                        }
+                    }
+                }
+
+                task.neighborCounts_.Push(task.neighborList_.Size() - listBegin);
             }
+        }
+    }
+}
 
-            // Молекулы слишком далеко и не взаимодействуют.
-            if (distance >= INTERACTION_RANGE)
-                continue;
+bool ContainerLogic::NeighborListsExpired() const
+{
+    float maxDisplacement = NEIGHBOR_SKIN * 0.5f;
+
+    for (int i = 0; i < GetNumMolecules(); i++)
+    {
+        float dx = posX_[i] - listPosX_[i];
+        float dy = posY_[i] - listPosY_[i];
 
-            // Направление от текущей молекулы до другой.
-            Vector3 direction = (anotherMoleculePos - moleculePos).Normalized();
-
-            // Сила отталкивая возрастает при уменьшении дистанции.
-            // Результат операции в диапазоне (0, 1).
-            float forceModulus = 1.0f - distance / INTERACTION_RANGE;
-
-            // Результат следующей операции также в диапазоне (0, 1), но график "прилипает" к нулю.
-            // То есть на больших расстояниях отталкивание мало, но при сближении
-            // молекул отталкивание резко (нелинейно) возрастает.
-            // Вдавленные друг в друга молекулы будут отталкиваться очень сильно.
-            forceModulus = forceModulus * forceModulus * forceModulus;
-
-            // Закон отталкивания мы получили, теперь усиливаем его.
-            forceModulus = forceModulus * 25.0f;
-            
-            // Если молекулы разного типа, то отталкивание сильнее, они хотят держаться друг от друга дальше.
-            if (GetMoleculeColor(molecule) != GetMoleculeColor(anotherMolecule))
-                forceModulus *= 2.0f;
-
-            Vector3 moleculeForce = molecule->GetVar("Force").GetVector3();
-            Vector3 newMoleculeForce = moleculeForce - forceModulus * direction;
-            molecule->SetVar("Force", newMoleculeForce);
-
-            Vector3 anotherMoleculeForce = anotherMolecule->GetVar("Force").GetVector3();
-            Vector3 newAnotherMoleculeForce = anotherMoleculeForce + forceModulus * direction;
-            anotherMolecule->SetVar("Force", newAnotherMoleculeForce);
+        if (dx * dx + dy * dy > maxDisplacement * maxDisplacement)
+            return true;
+    }
+
+    return false;
+}
+
+void ContainerLogic::BuildNeighborLists(int numTasks)
+{
+    FRAME_PROFILE(BuildNeighborLists);
+
+    int numMolecules = GetNumMolecules();
+    float cutoff = INTERACTION_RANGE + NEIGHBOR_SKIN;
+
+    // Сетка покрывает ёмкость с запасом, вылетевшие молекулы попадут в крайние ячейки.
+    float gridExtent = GetRadius() + cutoff;
+    grid_.Build(posX_.Buffer(), posY_.Buffer(), numMolecules, cutoff,
+        -gridExtent, -gridExtent, gridExtent, gridExtent);
+
+    // Задачи делят сетку на полосы строк.
+    numTasks = Min(numTasks, grid_.GetHeight());
+    for (int i = 0; i < numTasks; i++)
+    {
+        physicsTasks_[i].begin_ = grid_.GetHeight() * i / numTasks;
+        physicsTasks_[i].end_ = grid_.GetHeight() * (i + 1) / numTasks;
+    }
+
+    if (numTasks > 1)
+        RunPhysicsTasks(BuildNeighborListWork, numTasks);
+    else
+        BuildNeighborList(physicsTasks_[0]);
+
+    // Полосы идут по порядку слотов, поэтому списки задач просто склеиваются.
+    neighborStart_.Resize(numMolecules + 1);
+    int numNeighbors = 0;
+    int slot = 0;
+
+    for (int i = 0; i < numTasks; i++)
+    {
+        for (int count : physicsTasks_[i].neighborCounts_)
+        {
+            neighborStart_[slot++] = numNeighbors;
+            numNeighbors += count;
         }
     }
 
-    float containerRadius = GetRadius();
+    neighborStart_[numMolecules] = numNeighbors;
+    neighborIndices_.Resize(numNeighbors);
+
+    int offset = 0;
+    for (int i = 0; i < numTasks; i++)
+    {
+        const PODVector<int>& list = physicsTasks_[i].neighborList_;
+        if (!list.Empty())
+            memcpy(neighborIndices_.Buffer() + offset, list.Buffer(), list.Size() * sizeof(int));
+        offset += list.Size();
+    }
+
+    moleculeSlots_.Resize(numMolecules);
+    const int* slotMolecules = grid_.GetPoints();
+    for (int i = 0; i < numMolecules; i++)
+        moleculeSlots_[slotMolecules[i]] = i;
 
-    // Если молекулы вылетают за пределы сосуда, то сильно толкаем их назад.
-    for (Node* molecule : molecules)
+    listPosX_ = posX_;
+    listPosY_ = posY_;
+    neighborListsDirty_ = false;
+}
+
+void ContainerLogic::IntegrateMolecules(const PhysicsTask& task, float timeStep)
+{
+    // Затухание скорости за шаг. Молекулы долго продолжают двигаться с маленькой
+    // скоростью, пока не уснут (см. UpdateSleeping()).
+    float damping = expf(-VISCOSITY * timeStep);
+    float maxDisplacement2 = MAX_STEP_DISPLACEMENT * MAX_STEP_DISPLACEMENT;
+    float halfStep = timeStep * 0.5f;
+
+    for (int i = task.begin_; i < task.end_; i++)
     {
-        Vector3 pos = molecule->GetPosition();
+        if (!awake_[i])
+            continue;
+
+        // Расстояние до стенки и направление наружу ёмкости.
+        float normalX;
+        float normalY;
+        float distance = shape_.GetDistance(posX_[i], posY_[i], normalX, normalY);
 
-        if (pos.Length() > containerRadius - MOLECULE_RADIUS)
+        // Если молекулы вылетают за пределы сосуда, то сильно толкаем их назад.
+        if (distance > -MOLECULE_RADIUS)
         {
-            // Направление к центру ёмкости.
-            Vector3 backDirection = -pos.Normalized();
+            float backModulus = (distance + MOLECULE_RADIUS) * 200.0f;
+            forceX_[i] -= normalX * backModulus;
+            forceY_[i] -= normalY * backModulus;
+        }
 
-            float backModulus = (pos.Length() - containerRadius + MOLECULE_RADIUS) * 200.0f;
-            Vector3 force = molecule->GetVar("Force").GetVector3();
-            Vector3 newForce = force + backDirection * backModulus;
-            molecule->SetVar("Force", newForce);
+        float moveX;
+        float moveY;
+
+        if (integrator_ == PI_VELOCITY_VERLET)
+        {
+            // Скорость меняется под действием средней силы между прошлым и текущим шагом,
+            // а позиция учитывает ускорение в течение шага.
+            speedX_[i] += (prevForceX_[i] + forceX_[i]) * halfStep;
+            speedY_[i] += (prevForceY_[i] + forceY_[i]) * halfStep;
+            speedX_[i] *= damping;
+            speedY_[i] *= damping;
+            moveX = (speedX_[i] + forceX_[i] * halfStep) * timeStep;
+            moveY = (speedY_[i] + forceY_[i] * halfStep) * timeStep;
+            prevForceX_[i] = forceX_[i];
+            prevForceY_[i] = forceY_[i];
+        }
+        else
+        {
+            // Модифицируем скорость молекулы с учетом действующих на нее сил
+            // и применяем новую скорость.
+            speedX_[i] += forceX_[i] * timeStep;
+            speedY_[i] += forceY_[i] * timeStep;
+            speedX_[i] *= damping;
+            speedY_[i] *= damping;
+            moveX = speedX_[i] * timeStep;
+            moveY = speedY_[i] * timeStep;
         }
+
+        // Ограничиваем перемещение, а вместе с ним и скорость.
+        float move2 = moveX * moveX + moveY * moveY;
+        if (move2 > maxDisplacement2)
+        {
+            float scale = MAX_STEP_DISPLACEMENT / sqrtf(move2);
+            moveX *= scale;
+            moveY *= scale;
+            speedX_[i] *= scale;
+            speedY_[i] *= scale;
+        }
+
+        posX_[i] += moveX;
+        posY_[i] += moveY;
+
+        // Считаем, сколько времени молекула покоится.
+        float speed2 = speedX_[i] * speedX_[i] + speedY_[i] * speedY_[i];
+        float force2 = forceX_[i] * forceX_[i] + forceY_[i] * forceY_[i];
+        if (speed2 < SLEEP_SPEED * SLEEP_SPEED && force2 < SLEEP_FORCE * SLEEP_FORCE)
+            restTimes_[i] += timeStep;
+        else
+            restTimes_[i] = 0.0f;
+    }
+}
+
+void ContainerLogic::BuildNeighborListWork(const WorkItem* item, unsigned threadIndex)
+{
+    const ContainerLogic* logic = static_cast<ContainerLogic*>(item->aux_);
+    logic->BuildNeighborList(*static_cast<PhysicsTask*>(item->start_));
+}
+
+void ContainerLogic::CalculateForcesWork(const WorkItem* item, unsigned threadIndex)
+{
+    ContainerLogic* logic = static_cast<ContainerLogic*>(item->aux_);
+    logic->CalculateForces(*static_cast<PhysicsTask*>(item->start_));
+}
+
+void ContainerLogic::IntegrateMoleculesWork(const WorkItem* item, unsigned threadIndex)
+{
+    ContainerLogic* logic = static_cast<ContainerLogic*>(item->aux_);
+    // Шаг физики фиксированный, поэтому не передаем его в задачу.
+    logic->IntegrateMolecules(*static_cast<PhysicsTask*>(item->start_), logic->physicsStep_);
+}
+
+void ContainerLogic::RunPhysicsTasks(void (*workFunction)(const WorkItem*, unsigned), int numTasks)
+{
+    WorkQueue* queue = GetSubsystem<WorkQueue>();
+
+    for (int i = 0; i < numTasks; i++)
+    {
+        SharedPtr<WorkItem> item = queue->GetFreeItem();
+        item->priority_ = M_MAX_UNSIGNED;
+        item->workFunction_ = workFunction;
+        item->aux_ = this;
+        item->start_ = &physicsTasks_[i];
+        queue->AddWorkItem(item);
+    }
+
+    // Основной поток тоже участвует в выполнении задач.
+    queue->Complete(M_MAX_UNSIGNED);
+}
+
+void ContainerLogic::UpdateMolecules(float timeStep)
+{
+    FRAME_PROFILE(UpdateMolecules);
+
+    UpdateForces();
+    UpdatePositions(timeStep);
+}
+
+void ContainerLogic::UpdateForces()
+{
+    int numMolecules = GetNumMolecules();
+
+    if (allAsleep_)
+        return;
+
+    // Большие лужи считаем во всех потоках.
+    WorkQueue* queue = GetSubsystem<WorkQueue>();
+    int numTasks = 1;
+    if (queue && queue->GetNumThreads() > 0 && numMolecules >= PARALLEL_MIN_MOLECULES)
+        numTasks = (queue->GetNumThreads() + 1) * TASKS_PER_THREAD;
+
+    if ((int)physicsTasks_.Size() < numTasks)
+        physicsTasks_.Resize(numTasks);
+    numPhysicsTasks_ = numTasks;
+
+    // За один шаг молекулы сдвигаются на малую долю дистанции взаимодействия,
+    // поэтому списки соседей подходят для многих шагов подряд.
+    if (neighborListsDirty_ || NeighborListsExpired())
+        BuildNeighborLists(numTasks);
+
+    UpdateSleeping();
+    if (allAsleep_)
+        return;
+
+    // Вычисляем воздействия молекул друг на друга. Задачи делят слоты на равные диапазоны.
+    for (int i = 0; i < numTasks; i++)
+    {
+        physicsTasks_[i].begin_ = numMolecules * i / numTasks;
+        physicsTasks_[i].end_ = numMolecules * (i + 1) / numTasks;
     }
 
-    // Модифицируем скорости всех молекул, с учетом действующих на них сил.
-    for (Node* molecule : molecules)
+    if (numTasks > 1)
+        RunPhysicsTasks(CalculateForcesWork, numTasks);
+    else
+        CalculateForces(physicsTasks_[0]);
+
+    // Разлепляем совпавшие молекулы в фиксированном порядке (по слотам), чтобы
+    // последовательность случайных чисел не зависела от того, какой поток закончил первым.
+    for (int i = 0; i < numTasks; i++)
     {
-        Vector3 force = molecule->GetVar("Force").GetVector3();
-        Vector3 speed = molecule->GetVar("Speed").GetVector3();
-        Vector3 newSpeed = speed + force * timeStep;
-        molecule->SetVar("Speed", newSpeed);
+        for (int index : physicsTasks_[i].coincident_)
+            SeparateCoincident(index);
     }
+}
+
+void ContainerLogic::UpdatePositions(float timeStep)
+{
+    if (allAsleep_)
+        return;
+
+    int numMolecules = GetNumMolecules();
+    int numTasks = numPhysicsTasks_;
+
+    // Модифицируем скорости и позиции. Задачи делят молекулы на равные диапазоны.
+    for (int i = 0; i < numTasks; i++)
+    {
+        physicsTasks_[i].begin_ = numMolecules * i / numTasks;
+        physicsTasks_[i].end_ = numMolecules * (i + 1) / numTasks;
+    }
+
+    if (numTasks > 1)
+        RunPhysicsTasks(IntegrateMoleculesWork, numTasks);
+    else
+        IntegrateMolecules(physicsTasks_[0], timeStep);
+}
+
+void ContainerLogic::UpdateSleeping()
+{
+    FRAME_PROFILE(UpdateSleeping);
+
+    int numCells = grid_.GetWidth() * grid_.GetHeight();
+    cellStates_.Resize(numCells);
+    for (int i = 0; i < numCells; i++)
+        cellStates_[i] = CELL_UNVISITED;
 
-    // Вязкость (внутреннее трение жидкости). Замедляем молекулы со временем.
-    for (Node* molecule : molecules)
+    awake_.Resize(GetNumMolecules());
+    numAwakeMolecules_ = 0;
+
+    for (int startCell = 0; startCell < numCells; startCell++)
     {
-        Vector3 speed = molecule->GetVar("Speed").GetVector3();
+        if (cellStates_[startCell] != CELL_UNVISITED || grid_.GetCellBegin(startCell) == grid_.GetCellEnd(startCell))
+            continue;
+
+        // Обходим остров в глубину и проверяем, все ли его молекулы готовы уснуть.
+        bool awake = false;
+        islandCells_.Clear();
+        islandStack_.Clear();
+        islandStack_.Push(startCell);
+        cellStates_[startCell] = CELL_ASLEEP;
+
+        while (!islandStack_.Empty())
+        {
+            int cell = islandStack_.Back();
+            islandStack_.Pop();
+            islandCells_.Push(cell);
+
+            const int* cellEnd = grid_.GetCellEnd(cell);
+            for (const int* i = grid_.GetCellBegin(cell); i != cellEnd && !awake; ++i)
+            {
+                if (restTimes_[*i] < SLEEP_DELAY)
+                    awake = true;
+            }
+
+            int cellX = cell % grid_.GetWidth();
+            int cellY = cell / grid_.GetWidth();
+
+            for (int y = Max(cellY - 1, 0); y <= Min(cellY + 1, grid_.GetHeight() - 1); y++)
+            {
+                for (int x = Max(cellX - 1, 0); x <= Min(cellX + 1, grid_.GetWidth() - 1); x++)
+                {
+                    int neighbor = grid_.GetCellIndex(x, y);
 
-        // Чем больше значение скорости, тем быстрее она уменьшается.
-        // Однако молекулы долго продолжают двигаться с маленькой скоростью.
-        Vector3 newSpeed = speed.Lerp(Vector3::ZERO, timeStep * 0.5f);
+                    if (cellStates_[neighbor] == CELL_UNVISITED && grid_.GetCellBegin(neighbor) != grid_.GetCellEnd(neighbor))
+                    {
+                        cellStates_[neighbor] = CELL_ASLEEP;
+                        islandStack_.Push(neighbor);
+                    }
+                }
+            }
+        }
 
-        molecule->SetVar("Speed", newSpeed);
+        for (int cell : islandCells_)
+        {
+            cellStates_[cell] = awake ? CELL_AWAKE : CELL_ASLEEP;
+
+            const int* cellEnd = grid_.GetCellEnd(cell);
+            for (const int* i = grid_.GetCellBegin(cell); i != cellEnd; ++i)
+            {
+                awake_[*i] = awake;
+
+                // Спящие молекулы полностью останавливаем, иначе остаточная скорость
+                // подействует, когда они проснутся.
+                if (!awake)
+                {
+                    speedX_[*i] = speedY_[*i] = 0.0f;
+                    forceX_[*i] = forceY_[*i] = prevForceX_[*i] = prevForceY_[*i] = 0.0f;
+                }
+            }
+
+            if (awake)
+                numAwakeMolecules_ += grid_.GetCellEnd(cell) - grid_.GetCellBegin(cell);
+        }
     }
 
-    // Наконец, применяем расчитанные скорости.
-    for (Node* molecule : molecules)
+    allAsleep_ = numAwakeMolecules_ == 0;
+}
+
+void ContainerLogic::UpdateMoleculeGroup(float alpha)
+{
+    FRAME_PROFILE(UpdateMoleculeGroup);
+
+    // Трансформации нужны только для рендеринга, поэтому обновляем их один раз за кадр.
+    if (moleculeGroup_)
     {
-        Vector3 speed = molecule->GetVar("Speed").GetVector3();
-        molecule->Translate(speed * timeStep);
+        moleculeGroup_->UpdateMolecules(prevPosX_.Buffer(), prevPosY_.Buffer(), posX_.Buffer(), posY_.Buffer(),
+            colors_.Buffer(), GetNumMolecules(), alpha);
     }
 }
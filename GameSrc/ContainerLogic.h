@@ -4,13 +4,73 @@
 
 #pragma once
 #include "Global.h"
+#include "SpatialGrid.h"
+#include "ContainerShape.h"
+#include "MoleculeKernels.h"
+#include "MoleculeGroup.h"
+#include "Replay.h"
 
 // Число ходов при создании нового уровня.
 #define DEFAULT_TURNS_REMAIN 5
+// Число цветов молекул.
+#define NUM_COLORS 7
 // Радиус молекулы.
 #define MOLECULE_RADIUS 0.5f
+// Молекулы, находящиеся ближе этого расстояния, считаются соседними при заливке.
+// Это же расстояние используется как размер ячеек сетки для поиска молекул по координатам.
+#define FILL_NEIGHBOR_DISTANCE (MOLECULE_RADIUS * 2.2f)
+// Число шагов физики в секунду по умолчанию.
+#define DEFAULT_PHYSICS_RATE 60
+// Максимальное число шагов физики за один кадр по умолчанию. Если кадр длится дольше,
+// то лишнее время отбрасывается (симуляция замедляется, но остается устойчивой).
+#define DEFAULT_MAX_PHYSICS_SUBSTEPS 4
+// Сколько молекул меняет цвет за один шаг анимации заливки по умолчанию.
+#define DEFAULT_FILLING_MOLECULES_PER_STEP 5
+// Задержка между шагами анимации заливки по умолчанию.
+#define DEFAULT_FILLING_DELAY 0.02f
 // Быстрый доступ к ёмкости. Гарантируется, что ёмкость всегда доступна после инициализации игры.
-#define CONTAINER_LOGIC GLOBAL->scene_->GetChild("Container")->GetComponent<ContainerLogic>()
+#define CONTAINER_LOGIC GLOBAL->GetContainerLogic()
+
+// Способ интегрирования движения молекул.
+enum PhysicsIntegrator
+{
+    // Полунеявный (симплектический) метод Эйлера: скорость обновляется по силе,
+    // а позиция - по новой скорости.
+    PI_SEMI_IMPLICIT_EULER,
+    // Скоростной метод Верле: второй порядок точности при том же одном расчете сил
+    // за шаг. Выдерживает более длинные шаги, чем метод Эйлера.
+    PI_VELOCITY_VERLET
+};
+
+// Способ интегрирования по умолчанию.
+#define DEFAULT_INTEGRATOR PI_VELOCITY_VERLET
+
+// Имя способа интегрирования для логов и параметров командной строки.
+const char* GetIntegratorName(PhysicsIntegrator integrator);
+// Способ интегрирования по имени (без учета регистра). Возвращает false, если имя неизвестно.
+bool GetIntegratorByName(const char* name, PhysicsIntegrator& integrator);
+
+// Часть работы по расчету физики, выполняемая одним потоком.
+struct PhysicsTask
+{
+    // При построении списков соседей - диапазон строк сетки, при расчете сил - диапазон
+    // слотов (см. neighborStart_), при интегрировании - диапазон молекул.
+    int begin_;
+    int end_;
+    // Списки соседей молекул из строк задачи (в порядке слотов) и их длины.
+    // Потом они склеиваются в общий массив.
+    PODVector<int> neighborList_;
+    PODVector<int> neighborCounts_;
+    // Соседи молекулы в виде плотных массивов для ComputeRepulsion().
+    // У каждой задачи свои буферы, чтобы потоки не мешали друг другу.
+    PODVector<float> neighborX_;
+    PODVector<float> neighborY_;
+    PODVector<float> neighborColor_;
+    PODVector<float> neighborId_;
+    // Молекулы, которые находятся в одной точке с кем-то из соседей. Они разлепляются
+    // в основном потоке, так как для этого используется генератор случайных чисел.
+    PODVector<int> coincident_;
+};
 
 class ContainerLogic : public Component
 {
@@ -24,32 +84,292 @@ public:
     static void RegisterObject(Context* context);
     void HandleUpdate(StringHash eventType, VariantMap& eventData);
 
+    // Создает молекулу и возвращает ее индекс.
+    int CreateMolecule(const Vector3& pos, int color);
+    // Число молекул в ёмкости.
+    int GetNumMolecules() const { return colors_.Size(); }
+    // Ближайшая к точке молекула, внутри которой находится точка. Если такой нет, то -1.
+    // Точка задается в плоскости XOY.
+    int GetMoleculeAt(const Vector3& point);
+    // Добавляет в result все молекулы, которые пересекаются с кругом заданного радиуса.
+    void GetMoleculesInRadius(const Vector3& center, float radius, PODVector<int>& result);
     // Меняет цвет определенной молекулы. Цвет молекулы задается цифрами от 0 до 6.
-    void SetMoleculeColor(Node* molecule, int color);
-    // Заливка текущим цветом, начиная с определенной молекулы. Заливка на самом
+    void SetMoleculeColor(int index, int color);
+    // Индекс должен быть корректным, проверка не производится.
+    int GetMoleculeColor(int index) const { return colors_[index]; }
+    // Число молекул определенного цвета.
+    int GetColorCount(int color) const { return colorCounts_[color]; }
+    // Число цветов, молекулы которых есть в ёмкости.
+    int GetNumRemainingColors() const { return numRemainingColors_; }
+    // Проверяет, что все молекулы в ёмкости одинакового цвета (то есть уровень пройден).
+    bool IsSingleColor() const { return numRemainingColors_ <= 1; }
+    // Заливка цветом color, начиная с определенной молекулы. Заливка на самом
     // деле происходит в UpdateFilling, а в данной функции подготавливается список
-    // молекул, которые должны изменить цвет.
-    void Fill(Node* startMolecule);
+    // молекул, которые должны изменить цвет. Возвращает false, если стартовая
+    // молекула уже нужного цвета (ход не тратится).
+    bool Fill(int startIndex, int color);
+    // Сразу перекрашивает все молекулы, оставшиеся в очереди заливки.
+    void FinishFilling();
     // В данный момент производится заливка. Пользовательский ввод заблокирован.
-    bool FillingIsDoing() const { return filledMolecules_.Size() > 0; }
+    bool FillingIsDoing() const { return fillingHead_ < fillingTail_; }
+    // Число молекул, которые еще должны поменять цвет. Сразу после Fill() - все залитые молекулы.
+    int GetNumFillingMolecules() const { return fillingTail_ - fillingHead_; }
+    // Скорость анимации заливки: за один шаг меняют цвет moleculesPerStep молекул,
+    // шаги выполняются с интервалом delay секунд.
+    void SetFillingRate(int moleculesPerStep, float delay) { fillingMoleculesPerStep_ = moleculesPerStep; fillingStepDelay_ = delay; }
+    int GetFillingMoleculesPerStep() const { return fillingMoleculesPerStep_; }
+    float GetFillingDelay() const { return fillingStepDelay_; }
+
+    // Физика рассчитывается с фиксированным шагом независимо от ФПС.
+    void SetPhysicsRate(int stepsPerSecond) { physicsStep_ = 1.0f / stepsPerSecond; }
+    float GetPhysicsStep() const { return physicsStep_; }
+    void SetMaxPhysicsSubsteps(int maxSubsteps) { maxPhysicsSubsteps_ = maxSubsteps; }
+    int GetMaxPhysicsSubsteps() const { return maxPhysicsSubsteps_; }
+    void SetIntegrator(PhysicsIntegrator integrator);
+    PhysicsIntegrator GetIntegrator() const { return integrator_; }
+    // Делает заданное число шагов физики без учета времени кадра. Используется
+    // для расчета уровней без окна (см. BatchRunner.cpp).
+    void StepPhysics(int numSteps);
+    // Части шага физики, которые можно вызывать по отдельности для замеров
+    // (см. Benchmark.cpp). UpdatePositions() должна вызываться после UpdateForces().
+    // Вычисляет силы, действующие на молекулы.
+    void UpdateForces();
+    // Модифицирует скорости и позиции молекул по вычисленным силам.
+    void UpdatePositions(float timeStep);
+    // Генератор случайных чисел физики отделен от глобального, чтобы звуки и редактор
+    // не влияли на расчет. Зерно задается при запуске уровня (см. Replay.h).
+    void SetRandomSeed(unsigned seed) { randomSeed_ = seed; }
+    unsigned GetRandomSeed() const { return randomSeed_; }
+    // Число шагов физики с загрузки уровня или начала записи.
+    unsigned GetStepIndex() const { return stepIndex_; }
+    // Число молекул, которые не спят (см. UpdateSleeping()).
+    int GetNumAwakeMolecules() const { return numAwakeMolecules_; }
+    // Будит все молекулы.
+    void WakeAll();
+
+    // Форма ёмкости (см. ContainerShape.h). Пустой массив - круг.
+    void SetShape(const PODVector<Vector2>& vertices);
+    const PODVector<Vector2>& GetShape() const { return shape_.GetVertices(); }
+    // Форма в XML-файле уровня.
+    String GetShapeAttr() const { return ContainerShape::VerticesToString(shape_.GetVertices()); }
+    void SetShapeAttr(const String& value);
+
+    // Реализация расчета сил отталкивания. По умолчанию выбирается самая быстрая из
+    // поддерживаемых процессором. Все реализации дают одинаковый результат, поэтому
+    // скалярную можно использовать для проверки векторных.
+    void SetForceKernel(ForceKernel kernel);
+    ForceKernel GetForceKernel() const { return forceKernel_; }
+    // Сила, действующая на молекулу, по последнему вызову UpdateForces().
+    // Используется для сравнения реализаций (см. Benchmark.cpp).
+    Vector2 GetMoleculeForce(int index) const { return Vector2(forceX_[index], forceY_[index]); }
+
+    // Создает дочерние ноды с состоянием молекул. Вызывается перед сохранением
+    // сцены в файл, чтобы файлы уровней оставались совместимыми.
+    void WriteMoleculesToNodes();
+    // Удаляет ноды, созданные WriteMoleculesToNodes(). Вызывается после сохранения сцены.
+    void RemoveMoleculeNodes();
+
+    // Заменяет число ходов и молекулы данными уровня.
+    void LoadLevelData(const LevelData& level);
+    // Сохраняет радиус ёмкости, число ходов и молекулы для записи в двоичный уровень.
+    void SaveLevelData(LevelData& level) const;
+    // Запоминает текущее состояние ёмкости. Вызывается при запуске уровня, чтобы
+    // перезапускать его без чтения файла.
+    void TakeSnapshot() { SaveLevelData(snapshot_); }
+    // Возвращает ёмкость в запомненное состояние.
+    void RestoreSnapshot();
+
+    // Начинает запись заливок с текущего состояния ёмкости.
+    void StartRecording();
+    // Прерывает запись. Вызывается при переходе в редактор, так как изменения
+    // в редакторе не записываются.
+    void StopRecording() { recording_ = false; }
+    bool IsRecording() const { return recording_; }
+    // Завершает запись и возвращает ее.
+    const Replay& FinishRecording();
+    // Воспроизводит запись с начала до конца. Возвращает true, если конечное
+    // состояние побитово совпало с записанным.
+    bool PlayReplay(const Replay& replay);
+
+protected:
+    virtual void OnNodeSet(Node* node);
 
 private:
-    // Список молекул, которые должны поменять свой цвет в процессе заливки.
-    // Если этот список не пустой, значит в данный момент происходит заливка,
+    // Состояние молекул хранится в плоских массивах, а не в переменных нод,
+    // так как доступ к переменным нод идет через хеш-таблицу.
+    // Индекс молекулы одинаков во всех массивах.
+    PODVector<float> posX_;
+    PODVector<float> posY_;
+    PODVector<float> speedX_;
+    PODVector<float> speedY_;
+    PODVector<float> forceX_;
+    PODVector<float> forceY_;
+    // Силы на предыдущем шаге (нужны для скоростного метода Верле).
+    PODVector<float> prevForceX_;
+    PODVector<float> prevForceY_;
+    PODVector<int> colors_;
+    // Число молекул каждого цвета. Обновляется при создании молекул и смене цвета.
+    int colorCounts_[NUM_COLORS] = {};
+    // Число ненулевых элементов в colorCounts_.
+    int numRemainingColors_ = 0;
+    // Позиции молекул до последнего шага физики. Нужны для интерполяции
+    // отображаемых позиций между шагами.
+    PODVector<float> prevPosX_;
+    PODVector<float> prevPosY_;
+    // Сколько времени молекула покоится (скорость и сила меньше пороговых).
+    PODVector<float> restTimes_;
+    // Молекула не спит. Обновляется каждый шаг в UpdateSleeping().
+    PODVector<unsigned char> awake_;
+    // Для каждой ячейки grid_: не спит ли ее остров (или ячейка еще не проверена).
+    PODVector<unsigned char> cellStates_;
+    // Временные массивы для обхода островов.
+    PODVector<int> islandStack_;
+    PODVector<int> islandCells_;
+    int numAwakeMolecules_ = 0;
+    // Все молекулы спят, шаги физики ничего не делают.
+    bool allAsleep_ = false;
+    // Радиус ёмкости на прошлом шаге. Если стенки сдвинулись, то молекулы нужно будить,
+    // а форму ёмкости масштабировать.
+    float wallRadius_ = 0.0f;
+    // Форма ёмкости и поле расстояний до стенок.
+    ContainerShape shape_;
+    // Дно ёмкости (см. GetBottomNode()).
+    mutable WeakPtr<Node> bottomNode_;
+    // Трансформации в moleculeGroup_ устарели.
+    bool moleculeGroupDirty_ = true;
+
+    // Длительность одного шага физики.
+    float physicsStep_ = 1.0f / DEFAULT_PHYSICS_RATE;
+    // Ограничение числа шагов физики за кадр.
+    int maxPhysicsSubsteps_ = DEFAULT_MAX_PHYSICS_SUBSTEPS;
+    // Способ интегрирования.
+    PhysicsIntegrator integrator_ = DEFAULT_INTEGRATOR;
+    // Время, которое еще не было обработано физикой.
+    float physicsAccumulator_ = 0.0f;
+    // Отрисовка молекул. Трансформации обновляются один раз за кадр после расчета физики.
+    WeakPtr<MoleculeGroup> moleculeGroup_;
+    // Сетка для построения списков соседей (ячейки размером с дистанцию взаимодействия
+    // плюс запас). Перестраивается вместе со списками.
+    SpatialGrid grid_;
+    // Списки соседей (списки Верле): для каждой молекулы - все молекулы ближе
+    // INTERACTION_RANGE + NEIGHBOR_SKIN. Пока ни одна молекула не сдвинулась больше чем
+    // на половину запаса, все взаимодействующие пары есть в списках, и их не нужно
+    // перестраивать. Молекулы хранятся в порядке ячеек grid_ (слот молекулы - ее место
+    // в GetPoints()), поэтому соседние в памяти молекулы находятся рядом и в ёмкости.
+    // Соседи молекулы из слота k: neighborIndices_[neighborStart_[k]] ... neighborIndices_[neighborStart_[k + 1] - 1].
+    PODVector<int> neighborStart_;
+    PODVector<int> neighborIndices_;
+    // Слот каждой молекулы.
+    PODVector<int> moleculeSlots_;
+    // Позиции молекул при построении списков.
+    PODVector<float> listPosX_;
+    PODVector<float> listPosY_;
+    // Списки нужно перестроить независимо от перемещения молекул.
+    bool neighborListsDirty_ = true;
+    // Реализация расчета сил отталкивания.
+    ForceKernel forceKernel_;
+    // Задачи для потоков. Каждая молекула обрабатывается ровно одной задачей,
+    // поэтому результат не зависит от числа потоков.
+    Vector<PhysicsTask> physicsTasks_;
+    // Число задач в текущем шаге физики. Выбирается в UpdateForces().
+    int numPhysicsTasks_ = 1;
+
+    // Состояние ёмкости при запуске уровня.
+    LevelData snapshot_;
+    // Состояние генератора случайных чисел физики.
+    unsigned randomSeed_ = 1;
+    // Число шагов физики с загрузки уровня или начала записи.
+    unsigned stepIndex_ = 0;
+    // Запись текущего прохождения уровня.
+    Replay replay_;
+    bool recording_ = false;
+
+    // Материалы молекул для каждого цвета. Загружаются один раз при создании ёмкости.
+    SharedPtr<Material> colorMaterials_[NUM_COLORS];
+
+    // Сетка для заливки и поиска молекул по координатам (ячейки размером с дистанцию
+    // соседства при заливке). Строится только при необходимости.
+    SpatialGrid queryGrid_;
+    // Молекулы двигались или добавлялись после построения queryGrid_.
+    bool queryGridDirty_ = true;
+    // Битовый массив уже проверенных при заливке молекул.
+    PODVector<unsigned> fillVisited_;
+    // Очередь обхода в ширину. Каждая молекула попадает в нее не больше одного раза,
+    // поэтому достаточно массива на все молекулы. Порядок обхода совпадает с порядком
+    // смены цвета, поэтому после обхода эта же очередь используется для анимации.
+    PODVector<int> fillQueue_;
+    // Кандидаты в соседи очередной молекулы.
+    PODVector<int> fillCandidates_;
+    // Молекулы fillQueue_[fillingHead_] ... fillQueue_[fillingTail_ - 1] еще должны поменять
+    // свой цвет в процессе заливки. Если они есть, значит в данный момент происходит заливка,
     // и игрок не может кликать по молекулам и менять выбранный цвет.
-    PODVector<Node*> filledMolecules_;
-    // Задержка перед изменением цвета следующей молекулы в процессе заливки.
+    int fillingHead_ = 0;
+    int fillingTail_ = 0;
+    // Цвет, в который перекрашиваются молекулы при заливке.
+    int fillingColor_ = 0;
+    // Задержка перед изменением цвета следующих молекул в процессе заливки.
     float fillingDelay_ = 0.0f;
+    // Скорость анимации заливки.
+    int fillingMoleculesPerStep_ = DEFAULT_FILLING_MOLECULES_PER_STEP;
+    float fillingStepDelay_ = DEFAULT_FILLING_DELAY;
 
+    // Дно ёмкости. Радиус ёмкости нужен на каждом шаге физики, поэтому нода ищется
+    // по имени только при первом обращении и после пересоздания сцены. Если сцены
+    // или дна нет, то nullptr.
+    Node* GetBottomNode() const;
     // Радиус ёмкости. Модель дна емкости (белый круг) имеет радиус 1.
     // Значит реальный радиус ёмкости равен масштабу дна.
-    float GetRadius() const { return GLOBAL->scene_->GetChild("ContainerBottom")->GetScale().x_; }
-    // Нода не должна быть равна nullptr, проверка не производится.
-    int GetMoleculeColor(Node* molecule) const { return molecule->GetVar("Color").GetInt(); }
+    float GetRadius() const { return GetBottomNode()->GetScale().x_; }
+    // Рисует дно ёмкости по форме: круг - моделью, многоугольник - треугольниками
+    // из ContainerShape::Triangulate().
+    void UpdateBottomGeometry();
+    // Добавляет молекулу в массивы состояния.
+    void AddMolecule(const Vector3& pos, const Vector3& speed, int color);
+    // Перестраивает queryGrid_, если молекулы изменились.
+    void UpdateQueryGrid();
     // Анимация заливки.
     void UpdateFilling(float timeStep);
+    // Выполняет нужное число шагов физики фиксированной длины за время кадра.
+    void UpdatePhysics(float timeStep);
     // Обновление позиций молекул (весь расчет физики тут).
     void UpdateMolecules(float timeStep);
-    // Проверяет, что все молекулы в ёмкости одинакового цвета (то есть уровень пройден).
-    bool IsSingleColor();
+    // Масштабирует форму ёмкости и будит молекулы, если радиус ёмкости изменился.
+    void UpdateWalls();
+    // Разбивает молекулы на острова (группы соседних непустых ячеек grid_) и усыпляет
+    // острова, в которых все молекулы покоятся дольше SLEEP_DELAY. Остров спит целиком,
+    // так как на молекулу неспящего острова давят соседи, даже если сама она покоится.
+    // Молекулы разных островов не взаимодействуют, поэтому спящие острова можно не считать.
+    // Сетка строится по позициям при построении списков соседей, но этого достаточно:
+    // ячейки не меньше дистанции списков, а молекулы с тех пор сдвинулись меньше запаса.
+    void UpdateSleeping();
+    // Будит молекулу. Ее остров проснется на следующем шаге физики.
+    void WakeMolecule(int index);
+    // Какая-то молекула сдвинулась от позиции при построении списков соседей больше чем на половину запаса.
+    bool NeighborListsExpired() const;
+    // Перестраивает grid_ и списки соседей в numTasks задачах.
+    void BuildNeighborLists(int numTasks);
+    // Строит списки соседей молекул из строк сетки task.begin_ ... task.end_ - 1.
+    void BuildNeighborList(PhysicsTask& task) const;
+    // Собирает соседей молекулы из слота в буферы задачи.
+    NeighborBatch GatherNeighbors(int slot, PhysicsTask& task) const;
+    // Вычисляет силы отталкивания для молекул из слотов task.begin_ ... task.end_ - 1.
+    void CalculateForces(PhysicsTask& task);
+    // Разлепляет молекулу с соседями, находящимися с ней в одной точке.
+    void SeparateCoincident(int index);
+    // Применяет силы к молекулам task.begin_ ... task.end_ - 1.
+    void IntegrateMolecules(const PhysicsTask& task, float timeStep);
+    // Выполняет первые numTasks задач из physicsTasks_ в WorkQueue и дожидается их завершения.
+    void RunPhysicsTasks(void (*workFunction)(const WorkItem*, unsigned), int numTasks);
+    // Функции для WorkQueue.
+    static void BuildNeighborListWork(const WorkItem* item, unsigned threadIndex);
+    static void CalculateForcesWork(const WorkItem* item, unsigned threadIndex);
+    static void IntegrateMoleculesWork(const WorkItem* item, unsigned threadIndex);
+    // Передает позиции и цвета молекул в moleculeGroup_. Позиции интерполируются между
+    // предыдущим и текущим шагом физики: alpha = 0 - предыдущий шаг, alpha = 1 - текущий.
+    void UpdateMoleculeGroup(float alpha);
+    // Случайное число от min до max из генератора физики.
+    float PhysicsRandom(float min, float max);
+    // Учитывает в colorCounts_ появление или исчезновение молекулы данного цвета.
+    void IncrementColorCount(int color);
+    void DecrementColorCount(int color);
 };
@@ -0,0 +1,279 @@
+#include "ContainerShape.h"
+
+// Вершины, которые ближе этого расстояния (в масштабе ёмкости), считаются одной вершиной.
+static const float MIN_EDGE_LENGTH = 0.001f;
+// Если самая дальняя вершина отличается от единичного расстояния меньше чем на эту величину,
+// то вершины уже в масштабе ёмкости. В XML-файле числа хранятся с округлением.
+static const float SCALE_TOLERANCE = 0.0001f;
+
+// Удвоенная площадь треугольника со знаком: положительная, если вершины идут против часовой стрелки.
+static float Cross(const Vector2& a, const Vector2& b, const Vector2& c)
+{
+    return (b.x_ - a.x_) * (c.y_ - a.y_) - (b.y_ - a.y_) * (c.x_ - a.x_);
+}
+
+// Отрезки ab и cd пересекаются во внутренних точках.
+static bool SegmentsCross(const Vector2& a, const Vector2& b, const Vector2& c, const Vector2& d)
+{
+    float abc = Cross(a, b, c);
+    float abd = Cross(a, b, d);
+    float cda = Cross(c, d, a);
+    float cdb = Cross(c, d, b);
+    return ((abc > 0.0f && abd < 0.0f) || (abc < 0.0f && abd > 0.0f))
+        && ((cda > 0.0f && cdb < 0.0f) || (cda < 0.0f && cdb > 0.0f));
+}
+
+// Есть ли у многоугольника пересекающиеся несоседние ребра.
+static bool IsSelfIntersecting(const PODVector<Vector2>& vertices)
+{
+    unsigned numVertices = vertices.Size();
+
+    for (unsigned i = 0; i < numVertices; i++)
+    {
+        const Vector2& a = vertices[i];
+        const Vector2& b = vertices[(i + 1) % numVertices];
+
+        // Соседние ребра имеют общую вершину, их не проверяем.
+        for (unsigned j = i + 2; j < numVertices; j++)
+        {
+            if (i == 0 && j == numVertices - 1)
+                continue;
+
+            if (SegmentsCross(a, b, vertices[j], vertices[(j + 1) % numVertices]))
+                return true;
+        }
+    }
+
+    return false;
+}
+
+void ContainerShape::SetVertices(const PODVector<Vector2>& vertices)
+{
+    vertices_.Clear();
+
+    for (const Vector2& vertex : vertices)
+    {
+        if (vertices_.Empty() || (vertex - vertices_.Back()).Length() > MIN_EDGE_LENGTH)
+            vertices_.Push(vertex);
+    }
+
+    while (vertices_.Size() > 1 && (vertices_.Front() - vertices_.Back()).Length() <= MIN_EDGE_LENGTH)
+        vertices_.Pop();
+
+    // Удвоенная площадь со знаком: положительная, если вершины идут против часовой стрелки.
+    float area = 0.0f;
+    float maxLength = 0.0f;
+    for (unsigned i = 0, j = vertices_.Size() - 1; i < vertices_.Size(); j = i++)
+    {
+        area += vertices_[j].x_ * vertices_[i].y_ - vertices_[i].x_ * vertices_[j].y_;
+        maxLength = Max(maxLength, vertices_[i].Length());
+    }
+
+    if (vertices_.Size() >= 3 && IsSelfIntersecting(vertices_))
+    {
+        URHO3D_LOGWARNING("Container shape is self-intersecting, using a circle");
+        area = 0.0f;
+    }
+
+    if (vertices_.Size() < 3 || area == 0.0f || maxLength == 0.0f)
+    {
+        vertices_.Clear();
+        field_.Clear();
+        return;
+    }
+
+    if (area < 0.0f)
+    {
+        for (unsigned i = 0; i < vertices_.Size() / 2; i++)
+            Swap(vertices_[i], vertices_[vertices_.Size() - 1 - i]);
+    }
+
+    // Вершины из файла уровня уже в масштабе ёмкости. Не масштабируем их повторно,
+    // чтобы они не менялись при каждом сохранении.
+    if (Abs(maxLength - 1.0f) > SCALE_TOLERANCE)
+    {
+        for (Vector2& vertex : vertices_)
+            vertex /= maxLength;
+    }
+
+    BakeField();
+}
+
+float ContainerShape::ComputeDistance(float x, float y, float& normalX, float& normalY) const
+{
+    float minDistance2 = M_INFINITY;
+    float closestX = 0.0f;
+    float closestY = 0.0f;
+    unsigned closestEdge = 0;
+    bool inside = false;
+
+    for (unsigned i = 0, j = vertices_.Size() - 1; i < vertices_.Size(); j = i++)
+    {
+        const Vector2& a = vertices_[j];
+        const Vector2& b = vertices_[i];
+        float edgeX = b.x_ - a.x_;
+        float edgeY = b.y_ - a.y_;
+
+        // Ближайшая к точке точка ребра.
+        float t = Clamp(((x - a.x_) * edgeX + (y - a.y_) * edgeY) / (edgeX * edgeX + edgeY * edgeY), 0.0f, 1.0f);
+        float pointX = a.x_ + edgeX * t;
+        float pointY = a.y_ + edgeY * t;
+        float distance2 = (x - pointX) * (x - pointX) + (y - pointY) * (y - pointY);
+
+        if (distance2 < minDistance2)
+        {
+            minDistance2 = distance2;
+            closestX = pointX;
+            closestY = pointY;
+            closestEdge = i;
+        }
+
+        // Луч вправо от точки пересекает ребро.
+        if ((a.y_ > y) != (b.y_ > y) && x < a.x_ + (y - a.y_) * edgeX / edgeY)
+            inside = !inside;
+    }
+
+    float distance = sqrtf(minDistance2);
+
+    if (distance > 0.0f)
+    {
+        // Снаружи направление от ближайшей точки к данной, внутри - наоборот.
+        float sign = inside ? -1.0f : 1.0f;
+        normalX = (x - closestX) / distance * sign;
+        normalY = (y - closestY) / distance * sign;
+    }
+    else
+    {
+        // Точка на стенке. Вершины идут против часовой стрелки, поэтому внешняя
+        // нормаль ребра направлена вправо от него.
+        const Vector2& a = vertices_[closestEdge == 0 ? vertices_.Size() - 1 : closestEdge - 1];
+        const Vector2& b = vertices_[closestEdge];
+        Vector2 normal = Vector2(b.y_ - a.y_, a.x_ - b.x_).Normalized();
+        normalX = normal.x_;
+        normalY = normal.y_;
+    }
+
+    return inside ? -distance : distance;
+}
+
+void ContainerShape::BakeField()
+{
+    field_.Resize(FIELD_WIDTH * FIELD_WIDTH);
+
+    for (int y = 0; y < FIELD_WIDTH; y++)
+    {
+        float posY = y / FIELD_CELLS_PER_UNIT - SHAPE_FIELD_EXTENT;
+
+        for (int x = 0; x < FIELD_WIDTH; x++)
+        {
+            float posX = x / FIELD_CELLS_PER_UNIT - SHAPE_FIELD_EXTENT;
+            FieldNode& node = field_[y * FIELD_WIDTH + x];
+            node.distance_ = ComputeDistance(posX, posY, node.normalX_, node.normalY_);
+        }
+    }
+}
+
+void ContainerShape::Triangulate(PODVector<int>& indices) const
+{
+    indices.Clear();
+
+    // Вершины, которые еще не отрезаны.
+    PODVector<int> remaining;
+    for (unsigned i = 0; i < vertices_.Size(); i++)
+        remaining.Push(i);
+
+    while (remaining.Size() > 3)
+    {
+        unsigned numRemaining = remaining.Size();
+        bool earFound = false;
+
+        for (unsigned k = 0; k < numRemaining && !earFound; k++)
+        {
+            int prev = remaining[(k + numRemaining - 1) % numRemaining];
+            int current = remaining[k];
+            int next = remaining[(k + 1) % numRemaining];
+            const Vector2& a = vertices_[prev];
+            const Vector2& b = vertices_[current];
+            const Vector2& c = vertices_[next];
+
+            // Ухо - выпуклая вершина, в треугольнике которой нет других вершин.
+            if (Cross(a, b, c) <= 0.0f)
+                continue;
+
+            bool isEar = true;
+            for (int other : remaining)
+            {
+                if (other == prev || other == current || other == next)
+                    continue;
+
+                const Vector2& p = vertices_[other];
+                if (Cross(a, b, p) >= 0.0f && Cross(b, c, p) >= 0.0f && Cross(c, a, p) >= 0.0f)
+                {
+                    isEar = false;
+                    break;
+                }
+            }
+
+            if (!isEar)
+                continue;
+
+            indices.Push(prev);
+            indices.Push(current);
+            indices.Push(next);
+            remaining.Erase(k);
+            earFound = true;
+        }
+
+        // У простого многоугольника всегда есть ухо. Сюда можно попасть только из-за
+        // погрешностей на почти вырожденных вершинах, тогда остаток не рисуется.
+        if (!earFound)
+            return;
+    }
+
+    if (remaining.Size() == 3)
+    {
+        indices.Push(remaining[0]);
+        indices.Push(remaining[1]);
+        indices.Push(remaining[2]);
+    }
+}
+
+void ContainerShape::MakeStar(int numPoints, float innerRadius, PODVector<Vector2>& vertices)
+{
+    vertices.Clear();
+
+    bool regular = innerRadius >= 1.0f;
+    int numVertices = regular ? numPoints : numPoints * 2;
+
+    // Первая вершина сверху.
+    for (int i = 0; i < numVertices; i++)
+    {
+        float angle = 90.0f + 360.0f * i / numVertices;
+        float radius = regular || i % 2 == 0 ? 1.0f : innerRadius;
+        vertices.Push(Vector2(Cos(angle), Sin(angle)) * radius);
+    }
+}
+
+String ContainerShape::VerticesToString(const PODVector<Vector2>& vertices)
+{
+    String result;
+
+    for (const Vector2& vertex : vertices)
+    {
+        if (!result.Empty())
+            result += ' ';
+
+        result += String(vertex.x_) + " " + String(vertex.y_);
+    }
+
+    return result;
+}
+
+void ContainerShape::ParseVertices(const String& source, PODVector<Vector2>& vertices)
+{
+    vertices.Clear();
+
+    Vector<String> values = source.Split(' ');
+    for (unsigned i = 0; i + 1 < values.Size(); i += 2)
+        vertices.Push(Vector2(ToFloat(values[i]), ToFloat(values[i + 1])));
+}
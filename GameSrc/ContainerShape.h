@@ -0,0 +1,129 @@
+/*
+Форма ёмкости: круг или многоугольник.
+Вершины многоугольника задаются в масштабе ёмкости: самая дальняя от центра вершина
+лежит на расстоянии 1, поэтому радиус ёмкости (масштаб дна) остается радиусом описанной
+окружности, и все, что ограничивает ёмкость кругом этого радиуса, работает без изменений.
+
+Для многоугольника один раз заранее рассчитывается поле расстояний со знаком до стенки
+и направлений наружу (градиент расстояния) в узлах сетки, а при расчете физики значения
+берутся билинейной интерполяцией. Поэтому сила стенки считается за одно и то же время при
+любом числе вершин. Расстояние до масштабированной фигуры равно масштабированному
+расстоянию, поэтому поле рассчитывается в масштабе ёмкости, и при изменении радиуса
+(в редакторе) его не нужно пересчитывать. Для круга расстояние считается точно.
+*/
+
+#pragma once
+#include <Urho3D/Urho3DAll.h>
+
+// Число ячеек поля расстояний по каждой оси.
+#define SHAPE_FIELD_SIZE 128
+// Поле покрывает квадрат от -SHAPE_FIELD_EXTENT до SHAPE_FIELD_EXTENT в масштабе ёмкости,
+// то есть захватывает и молекулы, вылетевшие за стенку.
+#define SHAPE_FIELD_EXTENT 1.25f
+
+class ContainerShape
+{
+public:
+    // Задает многоугольник. Вершины могут идти в любом направлении и в любом масштабе,
+    // они приводятся к масштабу ёмкости. Меньше трех вершин - круг. Многоугольник
+    // с самопересечениями не поддерживается (у него нет внутренней области), вместо
+    // него тоже используется круг. Пересчитывает поле расстояний.
+    void SetVertices(const PODVector<Vector2>& vertices);
+    // Вершины в масштабе ёмкости против часовой стрелки. Если пусто, то ёмкость круглая.
+    const PODVector<Vector2>& GetVertices() const { return vertices_; }
+    bool IsCircle() const { return vertices_.Empty(); }
+
+    // Радиус ёмкости (масштаб фигуры).
+    void SetScale(float scale) { scale_ = scale; invScale_ = scale > 0.0f ? 1.0f / scale : 0.0f; }
+    float GetScale() const { return scale_; }
+
+    // Расстояние со знаком от точки до стенки (внутри ёмкости отрицательное) и направление
+    // наружу ёмкости. Для многоугольника значения приближенные, а направление может быть
+    // короче единицы у углов.
+    float GetDistance(float x, float y, float& normalX, float& normalY) const
+    {
+        if (vertices_.Empty())
+        {
+            float length = sqrtf(x * x + y * y);
+            if (length > 0.0f)
+            {
+                normalX = x / length;
+                normalY = y / length;
+            }
+            else
+            {
+                normalX = normalY = 0.0f;
+            }
+
+            return length - scale_;
+        }
+
+        // Координаты в ячейках поля.
+        float u = (x * invScale_ + SHAPE_FIELD_EXTENT) * FIELD_CELLS_PER_UNIT;
+        float v = (y * invScale_ + SHAPE_FIELD_EXTENT) * FIELD_CELLS_PER_UNIT;
+        float clampedU = Clamp(u, 0.0f, (float)SHAPE_FIELD_SIZE);
+        float clampedV = Clamp(v, 0.0f, (float)SHAPE_FIELD_SIZE);
+        int cellX = Min((int)clampedU, SHAPE_FIELD_SIZE - 1);
+        int cellY = Min((int)clampedV, SHAPE_FIELD_SIZE - 1);
+        float fracX = clampedU - cellX;
+        float fracY = clampedV - cellY;
+
+        const FieldNode* node00 = &field_[cellY * FIELD_WIDTH + cellX];
+        const FieldNode* node10 = node00 + 1;
+        const FieldNode* node01 = node00 + FIELD_WIDTH;
+        const FieldNode* node11 = node01 + 1;
+        float w00 = (1.0f - fracX) * (1.0f - fracY);
+        float w10 = fracX * (1.0f - fracY);
+        float w01 = (1.0f - fracX) * fracY;
+        float w11 = fracX * fracY;
+
+        normalX = node00->normalX_ * w00 + node10->normalX_ * w10 + node01->normalX_ * w01 + node11->normalX_ * w11;
+        normalY = node00->normalY_ * w00 + node10->normalY_ * w10 + node01->normalY_ * w01 + node11->normalY_ * w11;
+        float distance = node00->distance_ * w00 + node10->distance_ * w10 + node01->distance_ * w01 + node11->distance_ * w11;
+
+        // За пределами поля добавляем расстояние до его края.
+        if (u != clampedU || v != clampedV)
+        {
+            float outsideX = u - clampedU;
+            float outsideY = v - clampedV;
+            distance += sqrtf(outsideX * outsideX + outsideY * outsideY) / FIELD_CELLS_PER_UNIT;
+        }
+
+        return distance * scale_;
+    }
+
+    // Разбивает многоугольник на треугольники (отсечением ушей). В indices попадают
+    // по три номера вершин на треугольник, вершины треугольников идут против часовой стрелки.
+    void Triangulate(PODVector<int>& indices) const;
+
+    // Многоугольник с numPoints лучами: вершины на единичной окружности чередуются
+    // с вершинами на окружности радиуса innerRadius. При innerRadius = 1 - правильный многоугольник.
+    static void MakeStar(int numPoints, float innerRadius, PODVector<Vector2>& vertices);
+    // Вершины в виде строки "x y x y ..." (для атрибута компонента в XML-файле уровня).
+    static String VerticesToString(const PODVector<Vector2>& vertices);
+    static void ParseVertices(const String& source, PODVector<Vector2>& vertices);
+
+private:
+    static const int FIELD_WIDTH = SHAPE_FIELD_SIZE + 1;
+    static constexpr float FIELD_CELLS_PER_UNIT = SHAPE_FIELD_SIZE / (2.0f * SHAPE_FIELD_EXTENT);
+
+    // Значения в узле поля (в масштабе ёмкости).
+    struct FieldNode
+    {
+        float distance_;
+        float normalX_;
+        float normalY_;
+    };
+
+    PODVector<Vector2> vertices_;
+    // Узлы поля по строкам, FIELD_WIDTH x FIELD_WIDTH.
+    PODVector<FieldNode> field_;
+    float scale_ = 1.0f;
+    float invScale_ = 1.0f;
+
+    // Точное расстояние со знаком от точки до многоугольника в масштабе ёмкости
+    // и направление наружу.
+    float ComputeDistance(float x, float y, float& normalX, float& normalY) const;
+    // Рассчитывает поле расстояний по вершинам.
+    void BakeField();
+};
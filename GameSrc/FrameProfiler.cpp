@@ -0,0 +1,147 @@
+#include "FrameProfiler.h"
+#include "Urho3DAliases.h"
+
+// Статистика в DebugHud пересчитывается раз в столько кадров.
+static const int DEBUG_HUD_UPDATE_INTERVAL = 30;
+// Номер участка для кадра целиком.
+static const int FRAME_SECTION = 0;
+
+FrameProfiler::FrameProfiler(Context* context) : Object(context)
+{
+    RegisterSection("Frame");
+    UpdateNumSections();
+
+    // Конец рендеринга наступает перед ожиданием ограничителя ФПС, а конец кадра - после.
+    SubscribeToEvent(E_ENDRENDERING, URHO3D_HANDLER(FrameProfiler, HandleEndRendering));
+    SubscribeToEvent(E_ENDFRAME, URHO3D_HANDLER(FrameProfiler, HandleEndFrame));
+}
+
+Vector<String>& FrameProfiler::GetSectionNames()
+{
+    static Vector<String> sectionNames;
+    return sectionNames;
+}
+
+int FrameProfiler::RegisterSection(const char* name)
+{
+    Vector<String>& sectionNames = GetSectionNames();
+
+    for (int i = 0; i < (int)sectionNames.Size(); i++)
+    {
+        if (sectionNames[i] == name)
+            return i;
+    }
+
+    sectionNames.Push(name);
+    return sectionNames.Size() - 1;
+}
+
+void FrameProfiler::UpdateNumSections()
+{
+    int numSections = GetSectionNames().Size();
+
+    for (int i = history_.Size(); i < numSections; i++)
+    {
+        // Участок мог появиться не в первом кадре. В предыдущих кадрах его время нулевое.
+        history_.Push(PODVector<float>());
+        history_.Back().Resize(FRAME_PROFILER_HISTORY);
+        for (int j = 0; j < FRAME_PROFILER_HISTORY; j++)
+            history_.Back()[j] = 0.0f;
+
+        currentFrame_.Push(0.0f);
+    }
+}
+
+void FrameProfiler::AddTime(int section, long long usec)
+{
+    if (section >= (int)currentFrame_.Size())
+        UpdateNumSections();
+
+    currentFrame_[section] += usec / 1000.0f;
+}
+
+void FrameProfiler::HandleEndRendering(StringHash eventType, VariantMap& eventData)
+{
+    frameTime_ = frameTimer_.GetUSec(false) / 1000.0f;
+    frameTimeMeasured_ = true;
+}
+
+void FrameProfiler::HandleEndFrame(StringHash eventType, VariantMap& eventData)
+{
+    // Без рендеринга (например, в свернутом окне) замеряем кадр целиком.
+    if (!frameTimeMeasured_)
+        frameTime_ = frameTimer_.GetUSec(false) / 1000.0f;
+
+    currentFrame_[FRAME_SECTION] = frameTime_;
+
+    for (unsigned i = 0; i < history_.Size(); i++)
+    {
+        history_[i][historyPos_] = currentFrame_[i];
+        currentFrame_[i] = 0.0f;
+    }
+
+    historyPos_ = (historyPos_ + 1) % FRAME_PROFILER_HISTORY;
+    numFrames_ = Min(numFrames_ + 1, FRAME_PROFILER_HISTORY);
+
+    if (historyPos_ % DEBUG_HUD_UPDATE_INTERVAL == 0)
+        UpdateDebugHud();
+
+    frameTimeMeasured_ = false;
+    frameTimer_.Reset();
+}
+
+void FrameProfiler::UpdateDebugHud()
+{
+    DebugHud* debugHud = DEBUG_HUD;
+    if (!debugHud || numFrames_ == 0)
+        return;
+
+    const Vector<String>& sectionNames = GetSectionNames();
+
+    for (unsigned i = 0; i < history_.Size(); i++)
+    {
+        // Кадры в истории хранятся не по порядку, но для статистики порядок не важен.
+        sorted_.Resize(numFrames_);
+        float sum = 0.0f;
+        for (int j = 0; j < numFrames_; j++)
+        {
+            sorted_[j] = history_[i][j];
+            sum += sorted_[j];
+        }
+
+        Sort(sorted_.Begin(), sorted_.End());
+        float p99 = sorted_[Min(numFrames_ * 99 / 100, numFrames_ - 1)];
+
+        debugHud->SetAppStats(sectionNames[i], ToString("min %.2f avg %.2f p99 %.2f ms",
+            sorted_[0], sum / numFrames_, p99));
+    }
+}
+
+bool FrameProfiler::SaveCSV(const String& fileName) const
+{
+    File file(context_, fileName, FILE_WRITE);
+    if (!file.IsOpen())
+        return false;
+
+    const Vector<String>& sectionNames = GetSectionNames();
+
+    String line = "FrameIndex";
+    for (unsigned i = 0; i < history_.Size(); i++)
+        line += "," + sectionNames[i];
+    file.WriteLine(line);
+
+    // Если буфер заполнен, то самый старый кадр находится на позиции следующей записи.
+    int first = numFrames_ < FRAME_PROFILER_HISTORY ? 0 : historyPos_;
+
+    for (int j = 0; j < numFrames_; j++)
+    {
+        int pos = (first + j) % FRAME_PROFILER_HISTORY;
+
+        line = String(j);
+        for (unsigned i = 0; i < history_.Size(); i++)
+            line += ToString(",%.3f", history_[i][pos]);
+        file.WriteLine(line);
+    }
+
+    return true;
+}
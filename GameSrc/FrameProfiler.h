@@ -0,0 +1,113 @@
+/*
+Подсистема для замера времени игрового кода по кадрам.
+Участки кода отмечаются макросом FRAME_PROFILE(Имя). Время участка суммируется за кадр,
+а последние FRAME_PROFILER_HISTORY кадров хранятся для статистики: минимум, среднее
+и 99-й процентиль показываются в DebugHud (клавиша F2), а при выходе из игры вся история
+записывается в CSV-файл. Участки должны выполняться только в основном потоке.
+Участки могут быть вложенными. Для каждого участка учитывается только его собственное
+время, без вложенных участков, поэтому время участков не считается дважды, и их сумма
+не больше времени кадра (участок Frame - кадр целиком).
+*/
+
+#pragma once
+#include <Urho3D/Urho3DAll.h>
+
+#define FRAME_PROFILER GetSubsystem<FrameProfiler>()
+
+// Число кадров в истории.
+#define FRAME_PROFILER_HISTORY 600
+
+class FrameProfileBlock;
+
+// Замеряет время до конца блока. Участок также попадает в профайлер движка.
+// Если подсистема не создана (например, в PuddleBatch), то время не замеряется.
+#define FRAME_PROFILE(name) \
+    URHO3D_PROFILE(name); \
+    static const int frameProfileSection_##name = FrameProfiler::RegisterSection(#name); \
+    FrameProfileBlock frameProfileBlock_##name(GetSubsystem<FrameProfiler>(), frameProfileSection_##name)
+
+class FrameProfiler : public Object
+{
+    URHO3D_OBJECT(FrameProfiler, Object);
+
+public:
+    FrameProfiler(Context* context);
+
+    // Возвращает номер участка. Вызывается один раз для каждого участка из FRAME_PROFILE.
+    static int RegisterSection(const char* name);
+    // Добавляет время участка к текущему кадру.
+    void AddTime(int section, long long usec);
+    // Самый вложенный из выполняющихся участков.
+    FrameProfileBlock* GetCurrentBlock() const { return currentBlock_; }
+    void SetCurrentBlock(FrameProfileBlock* block) { currentBlock_ = block; }
+    // Записывает историю: строка на кадр, столбец на участок (в миллисекундах).
+    bool SaveCSV(const String& fileName) const;
+
+private:
+    // История кадров для каждого участка (в миллисекундах). Нулевой участок - кадр целиком.
+    Vector<PODVector<float> > history_;
+    // Время участков в текущем кадре.
+    PODVector<float> currentFrame_;
+    // Позиция в кольцевом буфере истории, куда будет записан следующий кадр.
+    int historyPos_ = 0;
+    // Число записанных кадров (не больше FRAME_PROFILER_HISTORY).
+    int numFrames_ = 0;
+    // Время кадра без ожидания ограничителя ФПС.
+    HiresTimer frameTimer_;
+    float frameTime_ = 0.0f;
+    bool frameTimeMeasured_ = false;
+    // Временный массив для вычисления процентиля.
+    PODVector<float> sorted_;
+    FrameProfileBlock* currentBlock_ = nullptr;
+
+    // Имена участков. Общие для всех экземпляров, так как номера участков
+    // хранятся в статических переменных.
+    static Vector<String>& GetSectionNames();
+    // Добавляет массивы для новых участков.
+    void UpdateNumSections();
+    // Показывает статистику в DebugHud.
+    void UpdateDebugHud();
+
+    void HandleEndRendering(StringHash eventType, VariantMap& eventData);
+    void HandleEndFrame(StringHash eventType, VariantMap& eventData);
+};
+
+// Замер времени участка. Создается макросом FRAME_PROFILE.
+class FrameProfileBlock
+{
+public:
+    FrameProfileBlock(FrameProfiler* profiler, int section) :
+        profiler_(profiler),
+        section_(section)
+    {
+        if (profiler_)
+        {
+            parent_ = profiler_->GetCurrentBlock();
+            profiler_->SetCurrentBlock(this);
+        }
+    }
+
+    ~FrameProfileBlock()
+    {
+        if (!profiler_)
+            return;
+
+        // Время вложенных участков уже учтено в них самих.
+        long long usec = timer_.GetUSec(false);
+        profiler_->AddTime(section_, usec - childUSec_);
+
+        if (parent_)
+            parent_->childUSec_ += usec;
+
+        profiler_->SetCurrentBlock(parent_);
+    }
+
+private:
+    FrameProfiler* profiler_;
+    int section_;
+    // Участок, внутри которого выполняется данный.
+    FrameProfileBlock* parent_ = nullptr;
+    // Полное время вложенных участков.
+    long long childUSec_ = 0;
+    HiresTimer timer_;
+};
@@ -5,9 +5,10 @@
 #include "Urho3DAliases.h"
 #include "Utils.h"
 #include "Config.h"
+#include "LevelLoader.h"
+#include "FrameProfiler.h"
+#include "LevelSolver.h"
 
-// Имена файлов материалов молекул определены в ContainerLogic.cpp.
-extern const char* colorFiles[];
 // Радиус сосуда при создании нового уровня.
 #define DEFAULT_CONTAINER_RADIUS 5.0f
 // Обычный цвет фона.
@@ -16,6 +17,24 @@ static const Color FOG_COLOR(0.4f, 0.5f, 0.8f);
 static const Color FOG_COLOR_EDITOR(0.8f, 0.5f, 0.4f);
 // Задержка в секундах перед растартом уровня при проигрыше.
 #define GAME_OVER_DELAY 1.0f
+// Радиус кисти для перекрашивания молекул в редакторе.
+#define EDITOR_BRUSH_RADIUS 1.0f
+
+// Формы ёмкости, которые перебираются клавишей F в редакторе: число лучей и радиус
+// внутренних вершин (см. ContainerShape::MakeStar()). Ноль лучей - круг.
+struct ShapePreset
+{
+    int numPoints_;
+    float innerRadius_;
+};
+
+static const ShapePreset shapePresets[] = {
+    { 0, 1.0f },
+    { 3, 1.0f },
+    { 4, 1.0f },
+    { 6, 1.0f },
+    { 5, 0.6f }
+};
 
 class Game : public Application
 {
@@ -30,6 +49,7 @@ public:
 
         // Регистрируем собственные компоненты.
         ContainerLogic::RegisterObject(context);
+        MoleculeGroup::RegisterObject(context);
         MyButton::RegisterObject(context_);
     }
 
@@ -43,12 +63,57 @@ public:
         // Собственная папка с ресурсами указывается перед стандартными.
         // Таким образом можно подсунуть движку свои ресурсы вместо стандартных.
         engineParameters_["ResourcePaths"] = "GameData;Data;CoreData";
+
+        // Параметр -seed N включает детерминированный режим.
+        // Параметры -rate N и -integrator Euler|Verlet меняют расчет физики.
+        const Vector<String>& arguments = GetArguments();
+        for (unsigned i = 0; i + 1 < arguments.Size(); i++)
+        {
+            if (arguments[i] == "-seed")
+            {
+                hasFixedSeed_ = true;
+                fixedSeed_ = ToUInt(arguments[i + 1]);
+            }
+            else if (arguments[i] == "-rate")
+            {
+                physicsRate_ = Max(ToInt(arguments[i + 1]), 0);
+            }
+            else if (arguments[i] == "-integrator")
+            {
+                if (!GetIntegratorByName(arguments[i + 1].CString(), integrator_))
+                    integrator_ = DEFAULT_INTEGRATOR;
+            }
+        }
     }
 
-    // Полный путь к файлу сцены.
-    String GetFullLevelPath(int index)
+    // Имя файла с записью последнего прохождения уровня.
+    String GetReplayFileName() const
     {
-        return FILE_SYSTEM->GetProgramDir() + "GameData/Scenes/" + CONFIG->GetLevelFileName(index);
+        return FILE_SYSTEM->GetAppPreferencesDir("1vanK", "PuddleSimulator") + "Replay" + REPLAY_FILE_EXTENSION;
+    }
+
+    // Начинает запись прохождения уровня с текущего состояния ёмкости.
+    void StartRecording()
+    {
+        // Изменения в редакторе не записываются, поэтому записывается только игра.
+        if (GLOBAL->gameState_ != GS_PLAY)
+            return;
+
+        CONTAINER_LOGIC->SetRandomSeed(hasFixedSeed_ ? fixedSeed_ : (unsigned)Rand());
+        CONTAINER_LOGIC->StartRecording();
+    }
+
+    // Сохраняет запись прохождения уровня, если она велась. Файл перезаписывается,
+    // поэтому в нем всегда последнее прохождение (его можно воспроизвести в PuddleBatch).
+    void SaveReplay()
+    {
+        // Перед загрузкой первого уровня ёмкости еще нет.
+        ContainerLogic* containerLogic = CONTAINER_LOGIC;
+        if (!containerLogic || !containerLogic->IsRecording())
+            return;
+
+        File file(context_, GetReplayFileName(), FILE_WRITE);
+        WriteReplay(file, containerLogic->FinishRecording());
     }
 
     // Меняет цвет фона и показывает/прячет дно ёмкости в зависимости
@@ -56,11 +121,9 @@ public:
     void UpdateFogColorAndContainerBottomVisible()
     {
         // Дно ёмкости видно только в режиме редактирования.
-        Node* bottomNode = GLOBAL->scene_->GetChild("ContainerBottom");
-        bottomNode->SetEnabled(GLOBAL->gameState_ == GS_EDITOR);
+        GLOBAL->GetContainerBottom()->SetEnabled(GLOBAL->gameState_ == GS_EDITOR);
 
-        Node* zoneNode = GLOBAL->scene_->GetChild("Zone");
-        Zone* zone = zoneNode->GetComponent<Zone>();
+        Zone* zone = GLOBAL->GetZone();
 
         // В режиме редактирования туман красного цвета.
         if (GLOBAL->gameState_ == GS_EDITOR)
@@ -72,8 +135,7 @@ public:
     // Показывает сцену на экране.
     void SetupViewport()
     {
-        Node* cameraNode = GLOBAL->scene_->GetChild("Camera");
-        Camera* camera = cameraNode->GetComponent<Camera>();
+        Camera* camera = GLOBAL->GetCamera();
         SharedPtr<Viewport> viewport(new Viewport(context_, GLOBAL->scene_, camera));
         RENDERER->SetViewport(0, viewport);
     }
@@ -81,26 +143,149 @@ public:
     // Загружает и запускает уровень.
     void StartLevel(int levelIndex)
     {
+        FRAME_PROFILE(StartLevel);
+
         levelIndex = Clamp(levelIndex, 0, CONFIG->GetNumLevels() - 1);
         GLOBAL->currentLevelIndex_ = GLOBAL->neededLevelIndex_ = levelIndex;
-        SharedPtr<File> file = CACHE->GetFile(GetFullLevelPath(levelIndex));
-        
-        // Если не удалось загрузить сцену, то создаем пустой уровень и переходим
-        // в режим редактирования.
-        if (!file || !GLOBAL->scene_->LoadXML(*file))
+
+        // Игрок мог уйти с недопройденного уровня.
+        SaveReplay();
+
+        // Обычно уровень уже загружен в фоне, и остается только создать сцену.
+        LevelData level;
+        CreateScene();
+
+        // Ёмкость создается заново вместе со сценой.
+        if (physicsRate_ > 0)
+            CONTAINER_LOGIC->SetPhysicsRate(physicsRate_);
+        CONTAINER_LOGIC->SetIntegrator(integrator_);
+
+        if (LEVEL_LOADER->GetLevel(levelIndex, level))
         {
-            CreateScene();
+            GLOBAL->GetContainerBottom()->SetScale(level.containerRadius_);
+            CONTAINER_LOGIC->LoadLevelData(level);
+        }
+        else
+        {
+            // Если не удалось загрузить уровень, то оставляем пустой уровень и переходим
+            // в режим редактирования.
             GLOBAL->gameState_ = GLOBAL->neededGameState_ = GS_EDITOR;
         }
 
+        // Запоминаем начальное состояние для перезапуска уровня.
+        CONTAINER_LOGIC->TakeSnapshot();
+        StartRecording();
+
+        // Пока игрок проходит уровень, загружаем соседние.
+        LEVEL_LOADER->PreloadAround(levelIndex);
+
         UpdateFogColorAndContainerBottomVisible();
         SetupViewport();
     }
 
+    // Сохраняет текущий уровень в двоичном формате.
+    void SaveBinaryLevel(const String& fileName)
+    {
+        LevelData level;
+        CONTAINER_LOGIC->SaveLevelData(level);
+        File file(context_, fileName, FILE_WRITE);
+        WriteLevelData(file, level);
+    }
+
+    // Создает двоичные файлы для всех уровней из списка по их XML-файлам.
+    void ConvertAllLevels()
+    {
+        for (int i = 0; i < CONFIG->GetNumLevels(); i++)
+            ConvertLevelFile(context_, LEVEL_LOADER->GetLevelPath(i), GetBinaryLevelFileName(LEVEL_LOADER->GetLevelPath(i)));
+    }
+
+    // Собирает все уровни из списка в архив GameData/Levels.pak.
+    void BuildLevelPack()
+    {
+        // Открытый архив отображен в память, перезаписывать его нельзя.
+        if (CONFIG->GetLevelPack())
+        {
+            URHO3D_LOGERROR("Level pack is in use, delete " + CONFIG->GetLevelPackFileName() + " and restart the game");
+            return;
+        }
+
+        LevelPack::Build(context_, CONFIG->GetLevelList(), CONFIG->GetLevelListFileName(),
+            FILE_SYSTEM->GetProgramDir() + "GameData/Scenes/", CONFIG->GetLevelPackFileName());
+    }
+
+    // Запускает поиск минимального числа ходов для текущего состояния ёмкости.
+    // Повторное нажатие прерывает поиск.
+    void SolveLevel()
+    {
+        if (solver_.IsRunning())
+        {
+            solver_.Cancel();
+            URHO3D_LOGINFO("Solver cancelled");
+            return;
+        }
+
+        LevelData level;
+        CONTAINER_LOGIC->SaveLevelData(level);
+
+        if (!solver_.Init(level))
+            return;
+
+        URHO3D_LOGINFOF("Solving level: %d regions", solver_.GetNumRegions());
+        solverLevelIndex_ = GLOBAL->currentLevelIndex_;
+        solverTimer_.Reset();
+        solverProgressTimer_.Reset();
+        solver_.Start(GetSubsystem<WorkQueue>());
+    }
+
+    // Следит за поиском, который идет в рабочих потоках. Когда поиск закончен, записывает
+    // число ходов в уровень. Сохранить уровень нужно отдельно (клавиша S).
+    void UpdateSolver()
+    {
+        if (!solver_.IsRunning())
+            return;
+
+        float seconds = solverTimer_.GetUSec(false) / 1000000.0f;
+
+        if (!solver_.Update())
+        {
+            // Раз в секунду сообщаем, как идет поиск.
+            if (solverProgressTimer_.GetMSec(false) >= 1000)
+            {
+                solverProgressTimer_.Reset();
+                URHO3D_LOGINFOF("Solver: checking %d turns, %u states, %.0f s",
+                    solver_.GetBound(), solver_.GetNumNodes(), seconds);
+            }
+
+            return;
+        }
+
+        const SolverResult& result = solver_.GetResult();
+
+        if (result.minTurns_ < 0)
+        {
+            URHO3D_LOGWARNINGF("Solver gave up after %u states (%.1f s), at least %d turns needed",
+                result.numNodes_, seconds, result.lowerBound_);
+            return;
+        }
+
+        URHO3D_LOGINFOF("Level solved in %d turns: %d regions, %u states, %.1f s",
+            result.minTurns_, solver_.GetNumRegions(), result.numNodes_, seconds);
+
+        for (const SolverMove& move : result.moves_)
+            URHO3D_LOGINFOF("  molecule %d -> color %d", move.molecule_, move.color_);
+
+        // Пока шел поиск, редактор мог загрузить другой уровень.
+        if (GLOBAL->gameState_ != GS_EDITOR || GLOBAL->currentLevelIndex_ != solverLevelIndex_)
+            return;
+
+        // Уровень без ходов нельзя начать, поэтому оставляем хотя бы один ход.
+        CONTAINER_LOGIC->turnsRemain_ = Max(result.minTurns_, 1);
+    }
+
     void Start()
     {
-        // Каждая игра будет уникальной.
-        SetRandomSeed(Time::GetSystemTime());
+        // Каждая игра будет уникальной (кроме детерминированного режима).
+        SetRandomSeed(hasFixedSeed_ ? fixedSeed_ : Time::GetSystemTime());
         // Блокируем Alt+Enter.
         INPUT->SetToggleFullscreen(false);
         // Ограничиваем ФПС, чтобы снизить нагрузку на систему.
@@ -116,9 +301,11 @@ public:
 
         // Создаем собственные подсистемы после инициализации встроенных,
         // так как они могут обращаться к встроенным в своих конструкторах.
+        context_->RegisterSubsystem(new FrameProfiler(context_));
         context_->RegisterSubsystem(new Config(context_));
         context_->RegisterSubsystem(new Global(context_));
         context_->RegisterSubsystem(new UIManager(context_));
+        context_->RegisterSubsystem(new LevelLoader(context_));
 
         // Используется одна сцена на всю игру, но она может полностью очищаться
         // и загружаться из файла.
@@ -169,11 +356,23 @@ public:
                 // Обновляем число завершенных уровней.
                 if (CONFIG->numCompletedLevels_ < GLOBAL->currentLevelIndex_ + 1)
                     CONFIG->numCompletedLevels_ = GLOBAL->currentLevelIndex_ + 1;
+
+                // Открылся следующий уровень, начинаем его загрузку.
+                LEVEL_LOADER->PreloadAround(GLOBAL->currentLevelIndex_);
+
+                SaveReplay();
             }
             else if (GLOBAL->gameState_ == GS_GAME_OVER)
             {
                 // Звук поражения.
                 GLOBAL->PlaySound("Sounds/GameOver.wav");
+
+                SaveReplay();
+            }
+            else if (GLOBAL->gameState_ == GS_EDITOR)
+            {
+                // Уровень будет изменен, и запись станет бесполезной.
+                CONTAINER_LOGIC->StopRecording();
             }
         }
 
@@ -182,9 +381,18 @@ public:
             GLOBAL->currentLevelIndex_ = GLOBAL->neededLevelIndex_;
             StartLevel(GLOBAL->currentLevelIndex_);
         }
+        else if (GLOBAL->neededRestartLevel_)
+        {
+            // Сцена не пересоздается, восстанавливается только состояние ёмкости.
+            SaveReplay();
+            CONTAINER_LOGIC->RestoreSnapshot();
+            StartRecording();
+        }
+
+        GLOBAL->neededRestartLevel_ = false;
     }
 
-    // Создает пустой уровень. Используется, если не удалось загрузить уровень из файла.
+    // Создает пустой уровень. Загруженные из файла уровни затем заполняются молекулами.
     void CreateScene()
     {
         Scene* scene = GLOBAL->scene_;
@@ -219,32 +427,22 @@ public:
         cameraNode->SetPosition(Vector3(0.0f, 0.0f, -20.0f));
         Camera* camera = cameraNode->CreateComponent<Camera>();
         camera->SetOrthographic(true);
+
+        // Старые ноды удалены вместе со сценой, ищем новые один раз здесь,
+        // а не при каждом обращении.
+        GLOBAL->UpdateSceneHandles();
     }
 
     // Создает молекулу.
     void CreateMolecule(const Vector3& pos, int color)
     {
-        Node* node = GLOBAL->scene_->GetChild("Container")->CreateChild();
-        node->SetPosition(pos);
-        // Индекс цвета хранится в переменной ноды.
-        node->SetVar("Color", color);
-
-        StaticModel* object = node->CreateComponent<StaticModel>();
-        object->SetModel(GET_MODEL("Models/Molecule.mdl"));
-        object->SetMaterial(GET_MATERIAL(colorFiles[color]));
+        CONTAINER_LOGIC->CreateMolecule(pos, color);
     }
 
     // Создает молекулу в случайном месте сосуда.
     void CreateMolecule(int color)
     {
-        // Случайное расстояние от центра.
-        float dist = Random(0.1f, DEFAULT_CONTAINER_RADIUS - MOLECULE_RADIUS);
-        // Случайный угол.
-        float angle = Random(0.0f, 360.0f);
-        // Итоговая координата.
-        Vector3 pos = Vector3(dist * sin(angle), dist * cos(angle), 0.0f);
-
-        CreateMolecule(pos, color);
+        CreateMolecule(RandomPointInCircle(0.1f, DEFAULT_CONTAINER_RADIUS - MOLECULE_RADIUS), color);
     }
 
     // Проецирует курсор на плоскость XOY.
@@ -252,12 +450,11 @@ public:
     {
         float mouseX = (float)INPUT->GetMousePosition().x_ / GRAPHICS->GetWidth();
         float mouseY = (float)INPUT->GetMousePosition().y_ / GRAPHICS->GetHeight();
-        Node* cameraNode = GLOBAL->scene_->GetChild("Camera");
-        Camera* camera = cameraNode->GetComponent<Camera>();
+        Camera* camera = GLOBAL->GetCamera();
         
         // Так как используется ортогональная камера и ее направление перпендикулярно
         // плоскости Z=0, то проецирование очень простое.
-        float distance = -cameraNode->GetPosition().z_;
+        float distance = -camera->GetNode()->GetPosition().z_;
         Vector3 result = camera->ScreenToWorldPoint(Vector3(mouseX, mouseY, distance));
         
         // Проверяем значение Z.
@@ -270,21 +467,12 @@ public:
         return result;
     }
 
-    // Молекула под курсором мыши.
-    Node* RaycastToMolecule() const
+    // Индекс молекулы под курсором мыши. Если под курсором нет молекулы, то -1.
+    // Все молекулы - круги в плоскости XOY, поэтому вместо рейкаста достаточно
+    // найти молекулу, в которую попадает проекция курсора.
+    int PickMolecule() const
     {
-        float mouseX = (float)INPUT->GetMousePosition().x_ / GRAPHICS->GetWidth();
-        float mouseY = (float)INPUT->GetMousePosition().y_ / GRAPHICS->GetHeight();
-        Camera* camera = GLOBAL->scene_->GetChild("Camera")->GetComponent<Camera>();
-        Ray cameraRay = camera->GetScreenRay(mouseX, mouseY);
-        PODVector<RayQueryResult> results;
-        RayOctreeQuery query(results, cameraRay, RAY_TRIANGLE, 1000.0f, DRAWABLE_GEOMETRY);
-        GLOBAL->scene_->GetComponent<Octree>()->RaycastSingle(query);
-        
-        if (results.Size())
-            return results[0].node_;
-        
-        return nullptr;
+        return CONTAINER_LOGIC->GetMoleculeAt(CursorToPlaneXOY());
     }
 
     // Край контейнера притягивается к курсору мыши.
@@ -293,14 +481,28 @@ public:
         IntVector2 mousePos = INPUT->GetMousePosition();
         float mouseX = (float)mousePos.x_ / GRAPHICS->GetWidth();
         float mouseY = (float)mousePos.y_ / GRAPHICS->GetHeight();
-        Node* cameraNode = GLOBAL->scene_->GetChild("Camera");
-        float depth = -cameraNode->GetPosition().z_;
-        Camera* camera = cameraNode->GetComponent<Camera>();
+        Camera* camera = GLOBAL->GetCamera();
+        float depth = -camera->GetNode()->GetPosition().z_;
         Vector3 worldPos = camera->ScreenToWorldPoint(Vector3(mouseX, mouseY, depth));
         float newRadius = worldPos.Length();
         // Модель дна контейнера (белый круг) имеет радиус 1. То есть новый
-        // радиус соответствует масштабу.
-        GLOBAL->scene_->GetChild("ContainerBottom")->SetScale(newRadius);
+        // радиус соответствует масштабу. Поле расстояний до стенок рассчитано в масштабе
+        // ёмкости, поэтому при изменении размера оно не пересчитывается.
+        GLOBAL->GetContainerBottom()->SetScale(newRadius);
+    }
+
+    // Меняет форму ёмкости на следующую из shapePresets.
+    void NextContainerShape()
+    {
+        int numPresets = sizeof(shapePresets) / sizeof(shapePresets[0]);
+        shapePresetIndex_ = (shapePresetIndex_ + 1) % numPresets;
+        const ShapePreset& preset = shapePresets[shapePresetIndex_];
+
+        PODVector<Vector2> vertices;
+        if (preset.numPoints_ > 0)
+            ContainerShape::MakeStar(preset.numPoints_, preset.innerRadius_, vertices);
+
+        CONTAINER_LOGIC->SetShape(vertices);
     }
 
     // Апдейт в состоянии GS_GAME_OVER.
@@ -315,7 +517,7 @@ public:
         if (gameOverTimer_ > GAME_OVER_DELAY)
         {
             GLOBAL->neededGameState_ = GS_PLAY;
-            GLOBAL->currentLevelIndex_ = -1;
+            GLOBAL->neededRestartLevel_ = true;
             gameOverTimer_ = 0.0f;
         }
     }
@@ -325,6 +527,7 @@ public:
         float timeStep = eventData[Update::P_TIMESTEP].GetFloat();
 
         UpdateFade(timeStep);
+        UpdateSolver();
 
         if (GLOBAL->gameState_ == GS_GAME_OVER)
         {
@@ -352,23 +555,64 @@ public:
         }
 
         // В режиме редактора меняем цвет молекул правой кнопкой мыши.
+        // С зажатым Ctrl меняется цвет всех молекул под кистью.
         if (INPUT->GetMouseButtonDown(MOUSEB_RIGHT) && GLOBAL->gameState_ == GS_EDITOR)
         {
-            Node* molecule = RaycastToMolecule();
+            if (INPUT->GetKeyDown(KEY_CTRL))
+            {
+                PODVector<int> molecules;
+                CONTAINER_LOGIC->GetMoleculesInRadius(CursorToPlaneXOY(), EDITOR_BRUSH_RADIUS, molecules);
+
+                for (int molecule : molecules)
+                    CONTAINER_LOGIC->SetMoleculeColor(molecule, UI_MANAGER->selectedColor_);
+            }
+            else
+            {
+                int molecule = PickMolecule();
 
-            if (molecule)
-                CONTAINER_LOGIC->SetMoleculeColor(molecule, UI_MANAGER->selectedColor_);
+                if (molecule != -1)
+                    CONTAINER_LOGIC->SetMoleculeColor(molecule, UI_MANAGER->selectedColor_);
+            }
         }
 
         // В режиме редактора сохраняем сцену при нажатии S.
         if (INPUT->GetKeyPress(KEY_S) && GLOBAL->gameState_ == GS_EDITOR)
         {
-            File file(context_, GetFullLevelPath(GLOBAL->currentLevelIndex_), FILE_WRITE);
+            // Переносим состояние молекул в ноды, чтобы оно попало в файл.
+            CONTAINER_LOGIC->WriteMoleculesToNodes();
+            File file(context_, LEVEL_LOADER->GetLevelPath(GLOBAL->currentLevelIndex_), FILE_WRITE);
             GLOBAL->scene_->SaveXML(file);
+            CONTAINER_LOGIC->RemoveMoleculeNodes();
+            // Двоичный файл загружается в первую очередь, поэтому его тоже нужно обновить.
+            SaveBinaryLevel(GetBinaryLevelFileName(LEVEL_LOADER->GetLevelPath(GLOBAL->currentLevelIndex_)));
+            // В кеше и в снимке для перезапуска осталась старая версия уровня.
+            LEVEL_LOADER->Invalidate(GLOBAL->currentLevelIndex_);
+            CONTAINER_LOGIC->TakeSnapshot();
+            // Пока архив открыт, уровни загружаются из него. Сохраненный уровень не совпадает
+            // с архивом, поэтому после перезапуска с -check-level-pack архив будет
+            // проигнорирован (см. Config::Load()).
+            if (CONFIG->GetLevelPack())
+                URHO3D_LOGWARNING("Level pack is in use and does not contain the saved level; rebuild the pack with P or restart with -check-level-pack");
             // Делаем дискету видимой.
             UI_MANAGER->floppyImage_->SetColor(Color::WHITE);
         }
 
+        // В режиме редактора создаем двоичные файлы для всех уровней при нажатии C.
+        if (INPUT->GetKeyPress(KEY_C) && GLOBAL->gameState_ == GS_EDITOR)
+            ConvertAllLevels();
+
+        // По нажатию клавиши P в режиме редактора собираем архив уровней.
+        if (INPUT->GetKeyPress(KEY_P) && GLOBAL->gameState_ == GS_EDITOR)
+            BuildLevelPack();
+
+        // По нажатию клавиши F в режиме редактора меняем форму ёмкости.
+        if (INPUT->GetKeyPress(KEY_F) && GLOBAL->gameState_ == GS_EDITOR)
+            NextContainerShape();
+
+        // По нажатию клавиши T в режиме редактора ищем минимальное число ходов (или прерываем поиск).
+        if (INPUT->GetKeyPress(KEY_T) && GLOBAL->gameState_ == GS_EDITOR)
+            SolveLevel();
+
         // По нажатию клавиши E игра переходит в режим редактора и обратно.
         // В процессе заливки режим менять нельзя.
         if (INPUT->GetKeyPress(KEY_E) && !CONTAINER_LOGIC->FillingIsDoing())
@@ -383,18 +627,44 @@ public:
         if (INPUT->GetMouseButtonPress(MOUSEB_LEFT) && !CONTAINER_LOGIC->FillingIsDoing()
             && GLOBAL->gameState_ == GS_PLAY)
         {
-            Node* molecule = RaycastToMolecule();
+            int molecule = PickMolecule();
             
-            if (molecule)
-                CONTAINER_LOGIC->Fill(molecule);
+            if (molecule != -1 && CONTAINER_LOGIC->Fill(molecule, UI_MANAGER->selectedColor_))
+                GLOBAL->PlaySound("Fill", "Sounds/Fill", 3);
         }
     }
 
     void Stop()
     {
+        // Рабочие потоки не должны обращаться к решателю после выхода.
+        solver_.Cancel();
         // Сохраняем конфиг при выходе из игры.
         CONFIG->Save();
+        // Сохраняем время последних кадров, чтобы по нему можно было найти медленные участки.
+        FRAME_PROFILER->SaveCSV(FILE_SYSTEM->GetAppPreferencesDir("1vanK", "PuddleSimulator") + "Profile.csv");
+        // Сохраняем запись недопройденного уровня.
+        SaveReplay();
     }
+
+private:
+    // Детерминированный режим (параметр командной строки -seed N): зерно генераторов
+    // случайных чисел одинаковое при каждом запуске игры и уровня.
+    bool hasFixedSeed_ = false;
+    unsigned fixedSeed_ = 0;
+    // Число шагов физики в секунду (параметр -rate N). Если ноль, то по умолчанию.
+    int physicsRate_ = 0;
+    // Способ интегрирования (параметр -integrator).
+    PhysicsIntegrator integrator_ = DEFAULT_INTEGRATOR;
+
+    // Последняя выбранная форма ёмкости (клавиша F в редакторе).
+    int shapePresetIndex_ = 0;
+
+    // Поиск минимального числа ходов (клавиша T в редакторе).
+    LevelSolver solver_;
+    // Уровень, для которого запущен поиск.
+    int solverLevelIndex_ = -1;
+    HiresTimer solverTimer_;
+    Timer solverProgressTimer_;
 };
 
 URHO3D_DEFINE_APPLICATION_MAIN(Game)
@@ -1,5 +1,6 @@
 #include "Global.h"
 #include "Urho3DAliases.h"
+#include "ContainerLogic.h"
 
 Global::Global(Context* context) : Object(context)
 {
@@ -7,6 +8,32 @@ Global::Global(Context* context) : Object(context)
     musicNode_ = new Node(context);
 }
 
+void Global::UpdateSceneHandles()
+{
+    containerLogic_.Reset();
+    containerBottom_.Reset();
+    camera_.Reset();
+    zone_.Reset();
+
+    // До загрузки первого уровня сцены еще нет.
+    if (!scene_)
+        return;
+
+    Node* containerNode = scene_->GetChild("Container");
+    if (containerNode)
+        containerLogic_ = containerNode->GetComponent<ContainerLogic>();
+
+    containerBottom_ = scene_->GetChild("ContainerBottom");
+
+    Node* cameraNode = scene_->GetChild("Camera");
+    if (cameraNode)
+        camera_ = cameraNode->GetComponent<Camera>();
+
+    Node* zoneNode = scene_->GetChild("Zone");
+    if (zoneNode)
+        zone_ = zoneNode->GetComponent<Zone>();
+}
+
 void Global::PlaySound(const String& fileName)
 {
     // Имя ноды равно имени проигрываемого звукового файла.
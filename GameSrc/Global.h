@@ -3,6 +3,8 @@
 
 #define GLOBAL GetSubsystem<Global>()
 
+class ContainerLogic;
+
 enum GameState
 {
     // В процессе игры.
@@ -30,6 +32,8 @@ public:
     int currentLevelIndex_ = 0;
     // Номер уровня, который будет загружен в начале следующей итерации игрового цикла.
     int neededLevelIndex_ = 0;
+    // Текущий уровень будет перезапущен в начале следующей итерации игрового цикла.
+    bool neededRestartLevel_ = false;
 
     Global(Context* context);
 
@@ -42,9 +46,25 @@ public:
     // Запускает зацикленное воспроизведение фоновой музыки.
     void PlayMusic(const String& fileName);
 
+    // Ноды и компоненты сцены, к которым игра обращается каждый кадр. Они ищутся по имени
+    // один раз после создания сцены, а не при каждом обращении. Указатели слабые: после
+    // Scene::Clear() или Scene::LoadXML() старые ноды удаляются, и при следующем обращении
+    // ноды ищутся заново. Если ноды нет, то возвращается nullptr.
+    ContainerLogic* GetContainerLogic() { if (containerLogic_.Expired()) UpdateSceneHandles(); return containerLogic_; }
+    Node* GetContainerBottom() { if (containerBottom_.Expired()) UpdateSceneHandles(); return containerBottom_; }
+    Camera* GetCamera() { if (camera_.Expired()) UpdateSceneHandles(); return camera_; }
+    Zone* GetZone() { if (zone_.Expired()) UpdateSceneHandles(); return zone_; }
+    // Ищет ноды и компоненты в сцене. Вызывается после создания или загрузки сцены.
+    void UpdateSceneHandles();
+
 private:
     // Корневая нода для всех источников звука. Не принадлежит ни одной сцене.
     SharedPtr<Node> soundRoot_;
     // Нода для музыкального проигрывателя. Не принадлежит ни одной сцене.
     SharedPtr<Node> musicNode_;
+
+    WeakPtr<ContainerLogic> containerLogic_;
+    WeakPtr<Node> containerBottom_;
+    WeakPtr<Camera> camera_;
+    WeakPtr<Zone> zone_;
 };
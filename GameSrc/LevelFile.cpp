@@ -0,0 +1,247 @@
+#include "LevelFile.h"
+#include "ContainerLogic.h"
+#include "Urho3DAliases.h"
+
+// Идентификатор двоичных файлов уровней.
+static const char* LEVEL_FILE_ID = "PUDL";
+// Версия формата. Увеличивается при любом изменении структуры файла.
+// 2 - форма ёмкости. Файлы версии 1 читаются как уровни с круглой ёмкостью.
+static const unsigned LEVEL_FILE_VERSION = 2;
+// Размер данных одной молекулы в файле.
+static const unsigned MOLECULE_DATA_SIZE = sizeof(float) * 4 + sizeof(unsigned char);
+
+void LevelData::Resize(int numMolecules)
+{
+    posX_.Resize(numMolecules);
+    posY_.Resize(numMolecules);
+    speedX_.Resize(numMolecules);
+    speedY_.Resize(numMolecules);
+    colors_.Resize(numMolecules);
+}
+
+bool ReadLevelData(Deserializer& source, LevelData& level)
+{
+    if (source.ReadFileID() != LEVEL_FILE_ID)
+    {
+        URHO3D_LOGERROR(source.GetName() + " is not a valid level file");
+        return false;
+    }
+
+    unsigned version = source.ReadUInt();
+    if (version != LEVEL_FILE_VERSION && version != 1)
+    {
+        URHO3D_LOGERRORF("Unsupported level file version %u in %s", version, source.GetName().CString());
+        return false;
+    }
+
+    level.containerRadius_ = source.ReadFloat();
+    level.containerShape_.Clear();
+
+    if (version >= 2)
+    {
+        unsigned numVertices = source.ReadUInt();
+
+        if (numVertices > (source.GetSize() - source.GetPosition()) / sizeof(Vector2))
+        {
+            URHO3D_LOGERROR(source.GetName() + " is truncated");
+            return false;
+        }
+
+        level.containerShape_.Resize(numVertices);
+        source.Read(level.containerShape_.Buffer(), numVertices * sizeof(Vector2));
+    }
+
+    level.turns_ = source.ReadInt();
+    unsigned numMolecules = source.ReadUInt();
+
+    // Защищаемся от обрезанных файлов, прежде чем выделять память.
+    if (numMolecules > (source.GetSize() - source.GetPosition()) / MOLECULE_DATA_SIZE)
+    {
+        URHO3D_LOGERROR(source.GetName() + " is truncated");
+        return false;
+    }
+
+    level.Resize(numMolecules);
+
+    // Массивы читаются целиком, без разбора отдельных значений.
+    source.Read(level.posX_.Buffer(), numMolecules * sizeof(float));
+    source.Read(level.posY_.Buffer(), numMolecules * sizeof(float));
+    source.Read(level.speedX_.Buffer(), numMolecules * sizeof(float));
+    source.Read(level.speedY_.Buffer(), numMolecules * sizeof(float));
+    source.Read(level.colors_.Buffer(), numMolecules);
+
+    for (unsigned i = 0; i < numMolecules; i++)
+    {
+        if (level.colors_[i] >= NUM_COLORS)
+        {
+            URHO3D_LOGERROR(source.GetName() + " contains an invalid molecule color");
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool WriteLevelData(Serializer& dest, const LevelData& level)
+{
+    unsigned numMolecules = level.GetNumMolecules();
+
+    bool success = true;
+    success &= dest.WriteFileID(LEVEL_FILE_ID);
+    success &= dest.WriteUInt(LEVEL_FILE_VERSION);
+    success &= dest.WriteFloat(level.containerRadius_);
+    unsigned numVertices = level.containerShape_.Size();
+    success &= dest.WriteUInt(numVertices);
+    success &= dest.Write(level.containerShape_.Buffer(), numVertices * sizeof(Vector2)) == numVertices * sizeof(Vector2);
+    success &= dest.WriteInt(level.turns_);
+    success &= dest.WriteUInt(numMolecules);
+    success &= dest.Write(level.posX_.Buffer(), numMolecules * sizeof(float)) == numMolecules * sizeof(float);
+    success &= dest.Write(level.posY_.Buffer(), numMolecules * sizeof(float)) == numMolecules * sizeof(float);
+    success &= dest.Write(level.speedX_.Buffer(), numMolecules * sizeof(float)) == numMolecules * sizeof(float);
+    success &= dest.Write(level.speedY_.Buffer(), numMolecules * sizeof(float)) == numMolecules * sizeof(float);
+    success &= dest.Write(level.colors_.Buffer(), numMolecules) == numMolecules;
+    return success;
+}
+
+String GetBinaryLevelFileName(const String& xmlFileName)
+{
+    return ReplaceExtension(xmlFileName, LEVEL_FILE_EXTENSION);
+}
+
+// Элемент атрибута с определенным именем у ноды или компонента.
+static XMLElement GetAttributeElement(const XMLElement& element, const String& name)
+{
+    for (XMLElement attribute = element.GetChild("attribute"); attribute; attribute = attribute.GetNext("attribute"))
+    {
+        if (attribute.GetAttribute("name") == name)
+            return attribute;
+    }
+
+    return XMLElement();
+}
+
+// Дочерняя нода с определенным именем.
+static XMLElement GetChildNodeElement(const XMLElement& element, const String& name)
+{
+    for (XMLElement node = element.GetChild("node"); node; node = node.GetNext("node"))
+    {
+        if (GetAttributeElement(node, "Name").GetAttribute("value") == name)
+            return node;
+    }
+
+    return XMLElement();
+}
+
+bool ReadLevelDataXML(XMLFile* sceneFile, LevelData& level)
+{
+    XMLElement sceneElement = sceneFile->GetRoot("scene");
+    XMLElement containerElement = GetChildNodeElement(sceneElement, "Container");
+    XMLElement bottomElement = GetChildNodeElement(sceneElement, "ContainerBottom");
+
+    if (!containerElement || !bottomElement)
+    {
+        URHO3D_LOGERROR(sceneFile->GetName() + " is not a valid level");
+        return false;
+    }
+
+    // Модель дна емкости имеет радиус 1, поэтому радиус ёмкости равен масштабу дна.
+    level.containerRadius_ = GetAttributeElement(bottomElement, "Scale").GetVector3("value").x_;
+
+    // Атрибуты со значением по умолчанию движок не сохраняет.
+    level.turns_ = DEFAULT_TURNS_REMAIN;
+    level.containerShape_.Clear();
+    for (XMLElement component = containerElement.GetChild("component"); component; component = component.GetNext("component"))
+    {
+        if (component.GetAttribute("type") != "ContainerLogic")
+            continue;
+
+        XMLElement turnsElement = GetAttributeElement(component, "Turns");
+        if (turnsElement)
+            level.turns_ = turnsElement.GetInt("value");
+
+        XMLElement shapeElement = GetAttributeElement(component, "Shape");
+        if (shapeElement)
+            ContainerShape::ParseVertices(shapeElement.GetAttribute("value"), level.containerShape_);
+    }
+
+    // Молекулы - дочерние ноды ёмкости. Номер цвета и скорость хранятся в переменных нод.
+    level.Resize(0);
+    for (XMLElement molecule = containerElement.GetChild("node"); molecule; molecule = molecule.GetNext("node"))
+    {
+        Vector3 position = GetAttributeElement(molecule, "Position").GetVector3("value");
+        VariantMap vars = GetAttributeElement(molecule, "Variables").GetVariantMap();
+        int color = vars[StringHash("Color")].GetInt();
+        Vector3 speed = vars[StringHash("Speed")].GetVector3();
+
+        if (color < 0 || color >= NUM_COLORS)
+        {
+            URHO3D_LOGERROR(sceneFile->GetName() + " contains an invalid molecule color");
+            return false;
+        }
+
+        level.posX_.Push(position.x_);
+        level.posY_.Push(position.y_);
+        level.speedX_.Push(speed.x_);
+        level.speedY_.Push(speed.y_);
+        level.colors_.Push((unsigned char)color);
+    }
+
+    return true;
+}
+
+bool LoadLevelFile(Context* context, const String& xmlFileName, LevelData& level)
+{
+    ResourceCache* cache = context->GetSubsystem<ResourceCache>();
+    FileSystem* fileSystem = context->GetSubsystem<FileSystem>();
+    String binaryFileName = GetBinaryLevelFileName(xmlFileName);
+
+    // Двоичный файл старше XML-файла, если XML-файл изменен не в игре (например, в редакторе
+    // Urho3D) после конвертации. Тогда загружаем XML-файл, иначе изменения молча терялись бы.
+    // У файлов в пакетах ресурсов движка нет пути на диске, их время не сравниваем.
+    String binaryPath = cache->GetResourceFileName(binaryFileName);
+    String xmlPath = cache->GetResourceFileName(xmlFileName);
+    bool binaryIsStale = !binaryPath.Empty() && !xmlPath.Empty()
+        && fileSystem->GetLastModifiedTime(binaryPath) < fileSystem->GetLastModifiedTime(xmlPath);
+
+    if (binaryIsStale)
+    {
+        URHO3D_LOGWARNING(binaryFileName + " is older than " + xmlFileName + " and is ignored, convert the level again with C in the editor");
+    }
+    else
+    {
+        SharedPtr<File> binaryFile = cache->GetFile(binaryFileName, false);
+        if (binaryFile && ReadLevelData(*binaryFile, level))
+            return true;
+    }
+
+    SharedPtr<File> file = cache->GetFile(xmlFileName, false);
+    if (!file)
+        return false;
+
+    SharedPtr<XMLFile> xmlFile(new XMLFile(context));
+    xmlFile->SetName(xmlFileName);
+    return xmlFile->Load(*file) && ReadLevelDataXML(xmlFile, level);
+}
+
+bool ConvertLevelFile(Context* context, const String& xmlFileName, const String& binaryFileName)
+{
+    SharedPtr<File> source = context->GetSubsystem<ResourceCache>()->GetFile(xmlFileName, false);
+    if (!source)
+        return false;
+
+    SharedPtr<XMLFile> xmlFile(new XMLFile(context));
+    xmlFile->SetName(xmlFileName);
+    LevelData level;
+    if (!xmlFile->Load(*source) || !ReadLevelDataXML(xmlFile, level))
+        return false;
+
+    File dest(context, binaryFileName, FILE_WRITE);
+    if (!dest.IsOpen() || !WriteLevelData(dest, level))
+    {
+        URHO3D_LOGERROR("Failed to write " + binaryFileName);
+        return false;
+    }
+
+    URHO3D_LOGINFOF("Converted %s (%d molecules)", xmlFileName.CString(), level.GetNumMolecules());
+    return true;
+}
@@ -0,0 +1,58 @@
+/*
+Компактный двоичный формат уровней.
+XML-файл сцены хранит для каждой молекулы ноду со всеми атрибутами и компонентом,
+поэтому он большой и медленно загружается. Двоичный файл хранит только то,
+что нужно для запуска уровня: радиус и форму ёмкости, число ходов и плотные массивы
+состояния молекул, которые копируются в ContainerLogic без разбора.
+
+Структура файла (все числа в порядке байтов little-endian):
+    "PUDL"                  идентификатор
+    uint32                  версия формата
+    float                   радиус ёмкости
+    uint32                  число вершин формы ёмкости K (0 - круг)
+    K x (float x, float y)  вершины в масштабе ёмкости (см. ContainerShape.h)
+    int32                   число ходов
+    uint32                  число молекул N
+    float[N] x N, float[N] y N, float[N] speed x, float[N] speed y
+    uint8[N]                цвета
+*/
+
+#pragma once
+#include <Urho3D/Urho3DAll.h>
+
+// Расширение двоичных файлов уровней.
+#define LEVEL_FILE_EXTENSION ".lvl"
+
+// Содержимое двоичного файла уровня.
+struct LevelData
+{
+    float containerRadius_ = 0.0f;
+    // Вершины многоугольника. Если пусто, то ёмкость круглая.
+    PODVector<Vector2> containerShape_;
+    int turns_ = 0;
+    PODVector<float> posX_;
+    PODVector<float> posY_;
+    PODVector<float> speedX_;
+    PODVector<float> speedY_;
+    PODVector<unsigned char> colors_;
+
+    int GetNumMolecules() const { return colors_.Size(); }
+    // Меняет размер всех массивов.
+    void Resize(int numMolecules);
+};
+
+// Читает уровень. Возвращает false, если файл поврежден или имеет другую версию.
+bool ReadLevelData(Deserializer& source, LevelData& level);
+// Извлекает уровень из XML-файла сцены без создания сцены.
+bool ReadLevelDataXML(XMLFile* sceneFile, LevelData& level);
+// Записывает уровень.
+bool WriteLevelData(Serializer& dest, const LevelData& level);
+
+// Имя двоичного файла, соответствующего XML-файлу уровня.
+String GetBinaryLevelFileName(const String& xmlFileName);
+// Загружает уровень из двоичного файла, а если его нет или он старше XML-файла, то из XML-файла.
+// Не создает сцену и не изменяет подсистемы (только читает файлы через ResourceCache
+// и FileSystem), поэтому может вызываться из рабочих потоков.
+bool LoadLevelFile(Context* context, const String& xmlFileName, LevelData& level);
+// Читает XML-файл уровня и сохраняет его в двоичном формате.
+bool ConvertLevelFile(Context* context, const String& xmlFileName, const String& binaryFileName);
@@ -0,0 +1,145 @@
+#include "LevelLoader.h"
+#include "Config.h"
+#include "FrameProfiler.h"
+#include "Urho3DAliases.h"
+
+LevelLoader::LevelLoader(Context* context) :
+    Object(context),
+    workQueue_(GetSubsystem<WorkQueue>())
+{
+}
+
+LevelLoader::~LevelLoader()
+{
+    // Задачи ссылаются на элементы кеша, поэтому дожидаемся их завершения.
+    for (CachedLevel* level : levels_)
+        WaitForLevel(level);
+}
+
+String LevelLoader::GetLevelPath(int levelIndex) const
+{
+    return FILE_SYSTEM->GetProgramDir() + "GameData/Scenes/" + CONFIG->GetLevelFileName(levelIndex);
+}
+
+LevelLoader::CachedLevel* LevelLoader::FindLevel(int levelIndex) const
+{
+    for (CachedLevel* level : levels_)
+    {
+        if (level->levelIndex_ == levelIndex)
+            return level;
+    }
+
+    return nullptr;
+}
+
+void LevelLoader::LoadLevelWork(const WorkItem* item, unsigned threadIndex)
+{
+    CachedLevel* level = static_cast<CachedLevel*>(item->start_);
+    Context* context = static_cast<Context*>(item->aux_);
+
+    if (level->pack_)
+        level->success_ = level->pack_->ReadLevel(level->levelIndex_, level->level_);
+    else
+        level->success_ = LoadLevelFile(context, level->fileName_, level->level_);
+}
+
+void LevelLoader::StartLoading(int levelIndex)
+{
+    SharedPtr<CachedLevel> level(new CachedLevel());
+    level->levelIndex_ = levelIndex;
+    level->fileName_ = GetLevelPath(levelIndex);
+    level->pack_ = CONFIG->GetLevelPack();
+    levels_.Push(level);
+
+    if (!workQueue_)
+    {
+        if (level->pack_)
+            level->success_ = level->pack_->ReadLevel(levelIndex, level->level_);
+        else
+            level->success_ = LoadLevelFile(context_, level->fileName_, level->level_);
+        return;
+    }
+
+    // Задача создается отдельно, а не берется из пула, так как пул обнуляет флаг
+    // completed_ завершенных задач, а нам нужно его проверять.
+    level->item_ = new WorkItem();
+    level->item_->priority_ = PRELOAD_PRIORITY;
+    level->item_->workFunction_ = LoadLevelWork;
+    level->item_->start_ = level;
+    level->item_->aux_ = context_;
+    workQueue_->AddWorkItem(level->item_);
+}
+
+void LevelLoader::WaitForLevel(CachedLevel* level)
+{
+    if (!level->item_ || !workQueue_)
+        return;
+
+    // Complete() выполняет задачи и в основном потоке, поэтому работает и без рабочих потоков.
+    while (!level->item_->completed_)
+        workQueue_->Complete(PRELOAD_PRIORITY);
+
+    level->item_.Reset();
+}
+
+void LevelLoader::PreloadAround(int levelIndex)
+{
+    // Следующий уровень загружаем только если он уже открыт.
+    int firstIndex = Max(levelIndex - 1, 0);
+    int lastIndex = Min(Min(levelIndex + 1, CONFIG->numCompletedLevels_), CONFIG->GetNumLevels() - 1);
+
+    // Удаляем из кеша далекие уровни. Уровни, которые еще загружаются, удалить нельзя,
+    // пока задача не убрана из очереди.
+    for (int i = (int)levels_.Size() - 1; i >= 0; i--)
+    {
+        CachedLevel* level = levels_[i];
+
+        if (level->levelIndex_ >= firstIndex && level->levelIndex_ <= lastIndex)
+            continue;
+
+        if (level->item_ && !level->item_->completed_ && !workQueue_->RemoveWorkItem(level->item_))
+            continue;
+
+        levels_.Erase(i);
+    }
+
+    for (int i = firstIndex; i <= lastIndex; i++)
+    {
+        if (!FindLevel(i))
+            StartLoading(i);
+    }
+}
+
+bool LevelLoader::GetLevel(int levelIndex, LevelData& level)
+{
+    FRAME_PROFILE(GetLevel);
+
+    CachedLevel* cachedLevel = FindLevel(levelIndex);
+
+    if (!cachedLevel)
+    {
+        StartLoading(levelIndex);
+        cachedLevel = levels_.Back();
+    }
+
+    WaitForLevel(cachedLevel);
+
+    // Уровень остается в кеше, чтобы его можно было быстро перезапустить.
+    if (cachedLevel->success_)
+        level = cachedLevel->level_;
+
+    return cachedLevel->success_;
+}
+
+void LevelLoader::Invalidate(int levelIndex)
+{
+    for (unsigned i = 0; i < levels_.Size(); i++)
+    {
+        if (levels_[i]->levelIndex_ == levelIndex)
+        {
+            WaitForLevel(levels_[i]);
+            levels_.Erase(i);
+            return;
+        }
+    }
+}
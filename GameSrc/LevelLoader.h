@@ -0,0 +1,61 @@
+/*
+Подсистема для загрузки уровней.
+Соседние с текущим уровни (предыдущий и следующий доступный) заранее читаются
+в рабочих потоках WorkQueue, поэтому при переходе между уровнями остается только
+создать сцену и скопировать в нее готовые массивы.
+*/
+
+#pragma once
+#include "LevelPack.h"
+
+#define LEVEL_LOADER GetSubsystem<LevelLoader>()
+
+class LevelLoader : public Object
+{
+    URHO3D_OBJECT(LevelLoader, Object);
+
+public:
+    LevelLoader(Context* context);
+    ~LevelLoader();
+
+    // Полный путь к XML-файлу уровня.
+    String GetLevelPath(int levelIndex) const;
+    // Запускает фоновую загрузку уровня и его соседей. Остальные уровни удаляются из кеша.
+    void PreloadAround(int levelIndex);
+    // Возвращает данные уровня. Если фоновая загрузка еще не закончилась, то дожидается ее,
+    // а если уровень не загружался, то загружает его сразу. Возвращает false, если файла нет.
+    bool GetLevel(int levelIndex, LevelData& level);
+    // Удаляет уровень из кеша. Вызывается, когда файл уровня изменился.
+    void Invalidate(int levelIndex);
+
+private:
+    // Уровень в кеше. Данные заполняются в рабочем потоке, поэтому основной поток
+    // не обращается к ним, пока задача не завершена.
+    struct CachedLevel : public RefCounted
+    {
+        int levelIndex_;
+        String fileName_;
+        // Если уровни загружаются из архива, то архив, иначе nullptr.
+        const LevelPack* pack_ = nullptr;
+        LevelData level_;
+        bool success_ = false;
+        SharedPtr<WorkItem> item_;
+    };
+
+    // Приоритет задач загрузки ниже, чем у задач физики, чтобы не задерживать кадр,
+    // но выше, чем у поиска решения (LevelSolver). WaitForLevel() вызывает Complete()
+    // с этим приоритетом и не должен дожидаться итерации поиска.
+    static const unsigned PRELOAD_PRIORITY = 1;
+
+    WeakPtr<WorkQueue> workQueue_;
+    Vector<SharedPtr<CachedLevel> > levels_;
+
+    // Уровень в кеше (возможно, еще загружающийся). Если его нет, то nullptr.
+    CachedLevel* FindLevel(int levelIndex) const;
+    // Добавляет уровень в кеш и запускает его загрузку.
+    void StartLoading(int levelIndex);
+    // Дожидается окончания загрузки уровня.
+    void WaitForLevel(CachedLevel* level);
+    // Функция для WorkQueue.
+    static void LoadLevelWork(const WorkItem* item, unsigned threadIndex);
+};
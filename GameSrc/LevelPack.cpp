@@ -0,0 +1,146 @@
+#include "LevelPack.h"
+
+// Идентификатор архива уровней.
+static const char* LEVEL_PACK_ID = "PLVP";
+// Версия формата архива.
+static const unsigned LEVEL_PACK_VERSION = 2;
+// Размер заголовка до оглавления.
+static const unsigned LEVEL_PACK_HEADER_SIZE = 16;
+
+// Оглавление читается из памяти напрямую, поэтому его размер не должен зависеть от компилятора.
+static_assert(sizeof(LevelPackEntry) == LEVEL_PACK_NAME_SIZE + 24, "Unexpected LevelPackEntry size");
+
+bool LevelPack::Open(const String& fileName)
+{
+    Close();
+
+    if (!file_.Open(fileName))
+        return false;
+
+    const unsigned char* data = file_.GetData();
+    unsigned size = file_.GetSize();
+
+    if (size < LEVEL_PACK_HEADER_SIZE || memcmp(data, LEVEL_PACK_ID, 4) != 0)
+    {
+        URHO3D_LOGERROR(fileName + " is not a valid level pack");
+        Close();
+        return false;
+    }
+
+    const unsigned* header = reinterpret_cast<const unsigned*>(data);
+    unsigned version = header[1];
+    unsigned numLevels = header[2];
+
+    if (version != LEVEL_PACK_VERSION)
+    {
+        URHO3D_LOGERRORF("Unsupported level pack version %u in %s", version, fileName.CString());
+        Close();
+        return false;
+    }
+
+    // Оглавление и все уровни должны помещаться в файл.
+    if (numLevels > (size - LEVEL_PACK_HEADER_SIZE) / sizeof(LevelPackEntry))
+    {
+        URHO3D_LOGERROR(fileName + " is truncated");
+        Close();
+        return false;
+    }
+
+    const LevelPackEntry* entries = reinterpret_cast<const LevelPackEntry*>(data + LEVEL_PACK_HEADER_SIZE);
+
+    for (unsigned i = 0; i < numLevels; i++)
+    {
+        const LevelPackEntry& entry = entries[i];
+
+        if (entry.offset_ > size || entry.size_ > size - entry.offset_
+            || entry.name_[LEVEL_PACK_NAME_SIZE - 1] != '\0')
+        {
+            URHO3D_LOGERROR(fileName + " has a corrupted index");
+            Close();
+            return false;
+        }
+    }
+
+    entries_ = entries;
+    numLevels_ = numLevels;
+    levelListTime_ = header[3];
+    return true;
+}
+
+void LevelPack::Close()
+{
+    file_.Close();
+    entries_ = nullptr;
+    numLevels_ = 0;
+    levelListTime_ = 0;
+}
+
+bool LevelPack::ReadLevel(int index, LevelData& level) const
+{
+    const LevelPackEntry& entry = entries_[index];
+
+    if (entry.size_ == 0)
+        return false;
+
+    MemoryBuffer source(file_.GetData() + entry.offset_, entry.size_);
+    return ReadLevelData(source, level);
+}
+
+bool LevelPack::Build(Context* context, const Vector<String>& levelNames, const String& levelListFileName,
+    const String& scenesDir, const String& packFileName)
+{
+    FileSystem* fileSystem = context->GetSubsystem<FileSystem>();
+    unsigned numLevels = levelNames.Size();
+    PODVector<LevelPackEntry> entries(numLevels);
+    VectorBuffer levelsData;
+    unsigned dataOffset = LEVEL_PACK_HEADER_SIZE + numLevels * sizeof(LevelPackEntry);
+
+    for (unsigned i = 0; i < numLevels; i++)
+    {
+        LevelPackEntry& entry = entries[i];
+        memset(&entry, 0, sizeof(entry));
+
+        if (levelNames[i].Length() >= LEVEL_PACK_NAME_SIZE)
+        {
+            URHO3D_LOGERROR("Level name " + levelNames[i] + " is too long for a level pack");
+            return false;
+        }
+
+        memcpy(entry.name_, levelNames[i].CString(), levelNames[i].Length());
+
+        // Для отсутствующих файлов время изменения нулевое.
+        String xmlFileName = scenesDir + levelNames[i];
+        entry.sourceTime_ = fileSystem->GetLastModifiedTime(xmlFileName);
+        entry.binaryTime_ = fileSystem->GetLastModifiedTime(GetBinaryLevelFileName(xmlFileName));
+
+        // Отсутствующие уровни тоже попадают в оглавление, чтобы номера уровней не сдвигались.
+        LevelData level;
+        if (!LoadLevelFile(context, xmlFileName, level))
+            continue;
+
+        unsigned levelOffset = levelsData.GetSize();
+        WriteLevelData(levelsData, level);
+
+        entry.offset_ = dataOffset + levelOffset;
+        entry.size_ = levelsData.GetSize() - levelOffset;
+        entry.numMolecules_ = level.GetNumMolecules();
+        entry.turns_ = level.turns_;
+    }
+
+    File dest(context, packFileName, FILE_WRITE);
+    if (!dest.IsOpen())
+        return false;
+
+    bool success = true;
+    success &= dest.WriteFileID(LEVEL_PACK_ID);
+    success &= dest.WriteUInt(LEVEL_PACK_VERSION);
+    success &= dest.WriteUInt(numLevels);
+    success &= dest.WriteUInt(fileSystem->GetLastModifiedTime(levelListFileName));
+    success &= dest.Write(entries.Buffer(), numLevels * sizeof(LevelPackEntry)) == numLevels * sizeof(LevelPackEntry);
+    success &= dest.Write(levelsData.GetData(), levelsData.GetSize()) == levelsData.GetSize();
+
+    if (!success)
+        URHO3D_LOGERROR("Failed to write " + packFileName);
+
+    return success;
+}
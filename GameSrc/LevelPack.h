@@ -0,0 +1,78 @@
+/*
+Архив со всеми уровнями игры в одном файле.
+Файл отображается в память, поэтому список уровней и их метаданные читаются прямо
+из заголовка без разбора строк, а уровень читается из памяти без открытия файлов.
+Массивы уровня при этом копируются (одним memcpy на массив) в LevelData: ёмкость
+изменяет состояние молекул, а отображение доступно только для чтения, поэтому
+полностью без копирования уровень не запустить.
+Игра доверяет архиву и не обращается к отдельным файлам уровней. Для разработки в архиве
+хранится время изменения GameData/Levels.txt и файлов каждого уровня на момент сборки,
+и с параметром -check-level-pack архив не используется, если файлы с тех пор изменились
+(см. Config::Load()).
+
+Структура файла (все числа в порядке байтов little-endian):
+    "PLVP"                      идентификатор
+    uint32                      версия формата
+    uint32                      число уровней N
+    uint32                      время изменения GameData/Levels.txt
+    LevelPackEntry[N]           оглавление
+    ...                         уровни в формате LevelFile.h
+*/
+
+#pragma once
+#include "LevelFile.h"
+#include "MappedFile.h"
+
+// Максимальная длина имени файла уровня (включая завершающий ноль).
+#define LEVEL_PACK_NAME_SIZE 64
+
+// Элемент оглавления архива.
+struct LevelPackEntry
+{
+    // Имя XML-файла уровня из списка GameData/Levels.txt, дополненное нулями.
+    char name_[LEVEL_PACK_NAME_SIZE];
+    // Положение уровня в архиве. Если размер равен 0, то уровень при создании архива
+    // не удалось загрузить.
+    unsigned offset_;
+    unsigned size_;
+    // Метаданные для отображения без чтения самого уровня.
+    unsigned numMolecules_;
+    int turns_;
+    // Время изменения XML-файла и двоичного файла уровня при сборке архива
+    // (0, если файла не было).
+    unsigned sourceTime_;
+    unsigned binaryTime_;
+};
+
+class LevelPack
+{
+public:
+    // Отображает архив в память и проверяет его оглавление.
+    bool Open(const String& fileName);
+    void Close();
+    bool IsOpen() const { return entries_ != nullptr; }
+
+    int GetNumLevels() const { return numLevels_; }
+    const char* GetLevelName(int index) const { return entries_[index].name_; }
+    int GetNumMolecules(int index) const { return entries_[index].numMolecules_; }
+    int GetTurns(int index) const { return entries_[index].turns_; }
+    // Время изменения файлов при сборке архива (для проверки, что архив не устарел).
+    unsigned GetLevelListTime() const { return levelListTime_; }
+    unsigned GetSourceTime(int index) const { return entries_[index].sourceTime_; }
+    unsigned GetBinaryTime(int index) const { return entries_[index].binaryTime_; }
+
+    // Копирует уровень из отображенной памяти в level без открытия файлов и разбора.
+    // Может вызываться из рабочих потоков.
+    bool ReadLevel(int index, LevelData& level) const;
+
+    // Собирает архив из уровней списка. Уровни загружаются так же, как при игре
+    // (двоичный файл или XML).
+    static bool Build(Context* context, const Vector<String>& levelNames, const String& levelListFileName,
+        const String& scenesDir, const String& packFileName);
+
+private:
+    MappedFile file_;
+    const LevelPackEntry* entries_ = nullptr;
+    int numLevels_ = 0;
+    unsigned levelListTime_ = 0;
+};
@@ -0,0 +1,754 @@
+#include "LevelSolver.h"
+#include "SpatialGrid.h"
+
+#include <thread>
+
+#ifdef _MSC_VER
+    #include <intrin.h>
+#endif
+
+// Номер младшего установленного бита. Значение не должно быть нулевым.
+static int CountTrailingZeros(unsigned long long value)
+{
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward64(&index, value);
+    return (int)index;
+#else
+    return __builtin_ctzll(value);
+#endif
+}
+
+void RegionSet::Clear()
+{
+    for (int i = 0; i < NUM_WORDS; i++)
+        words_[i] = 0;
+}
+
+bool RegionSet::Empty() const
+{
+    for (int i = 0; i < NUM_WORDS; i++)
+    {
+        if (words_[i])
+            return false;
+    }
+
+    return true;
+}
+
+bool RegionSet::Intersects(const RegionSet& rhs) const
+{
+    for (int i = 0; i < NUM_WORDS; i++)
+    {
+        if (words_[i] & rhs.words_[i])
+            return true;
+    }
+
+    return false;
+}
+
+int RegionSet::First() const
+{
+    for (int i = 0; i < NUM_WORDS; i++)
+    {
+        if (words_[i])
+            return i * 64 + CountTrailingZeros(words_[i]);
+    }
+
+    return -1;
+}
+
+int RegionSet::PopFirst()
+{
+    for (int i = 0; i < NUM_WORDS; i++)
+    {
+        if (words_[i])
+        {
+            int bit = CountTrailingZeros(words_[i]);
+            words_[i] &= words_[i] - 1;
+            return i * 64 + bit;
+        }
+    }
+
+    return -1;
+}
+
+void RegionSet::Remove(const RegionSet& rhs)
+{
+    for (int i = 0; i < NUM_WORDS; i++)
+        words_[i] &= ~rhs.words_[i];
+}
+
+RegionSet& RegionSet::operator |=(const RegionSet& rhs)
+{
+    for (int i = 0; i < NUM_WORDS; i++)
+        words_[i] |= rhs.words_[i];
+
+    return *this;
+}
+
+RegionSet& RegionSet::operator &=(const RegionSet& rhs)
+{
+    for (int i = 0; i < NUM_WORDS; i++)
+        words_[i] &= rhs.words_[i];
+
+    return *this;
+}
+
+unsigned long long SolverState::GetHash() const
+{
+    unsigned long long hash = 0;
+
+    for (int color = 0; color < NUM_COLORS; color++)
+    {
+        for (int i = 0; i < RegionSet::NUM_WORDS; i++)
+        {
+            hash = (hash ^ colors_[color].words_[i]) * 0x9E3779B97F4A7C15ull;
+            hash ^= hash >> 29;
+        }
+    }
+
+    return hash;
+}
+
+bool SolverState::operator ==(const SolverState& rhs) const
+{
+    return memcmp(colors_, rhs.colors_, sizeof(colors_)) == 0;
+}
+
+void TranspositionTable::SetSize(unsigned size)
+{
+    if (size != size_)
+    {
+        entries_ = new Entry[size];
+        size_ = size;
+    }
+
+    Clear();
+}
+
+void TranspositionTable::Clear()
+{
+    for (unsigned i = 0; i < size_; i++)
+    {
+        entries_[i].version_.store(0, std::memory_order_relaxed);
+        entries_[i].remaining_.store(-1, std::memory_order_relaxed);
+    }
+}
+
+bool TranspositionTable::Probe(const SolverState& state, unsigned long long hash, int remaining, int lastPiece) const
+{
+    const Entry& entry = entries_[(unsigned)hash & (size_ - 1)];
+
+    unsigned version = entry.version_.load(std::memory_order_acquire);
+    if (version & 1)
+        return false;
+
+    // Запись подходит, если при ее проверке было не меньше ходов и не больше ограничений.
+    if (entry.remaining_.load(std::memory_order_relaxed) < remaining
+        || entry.lastPiece_.load(std::memory_order_relaxed) > lastPiece
+        || entry.hash_.load(std::memory_order_relaxed) != hash)
+        return false;
+
+    for (int i = 0; i < NUM_STATE_WORDS; i++)
+    {
+        if (entry.words_[i].load(std::memory_order_relaxed) != GetStateWord(state, i))
+            return false;
+    }
+
+    // Если запись изменилась, пока мы ее читали, то прочитанное могло быть смесью двух записей.
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return entry.version_.load(std::memory_order_relaxed) == version;
+}
+
+void TranspositionTable::Store(const SolverState& state, unsigned long long hash, int remaining, int lastPiece)
+{
+    Entry& entry = entries_[(unsigned)hash & (size_ - 1)];
+
+    // Таблица - только кеш, поэтому если запись занята другим потоком, то просто пропускаем ее.
+    unsigned version = entry.version_.load(std::memory_order_relaxed);
+    if ((version & 1) || !entry.version_.compare_exchange_strong(version, version + 1, std::memory_order_acquire))
+        return;
+
+    // Нечетная версия должна стать видна раньше данных записи, иначе на процессорах
+    // со слабым порядком памяти (ARM) читатель может принять наполовину записанную
+    // запись за целую. Пара к барьеру в Probe().
+    std::atomic_thread_fence(std::memory_order_release);
+
+    for (int i = 0; i < NUM_STATE_WORDS; i++)
+        entry.words_[i].store(GetStateWord(state, i), std::memory_order_relaxed);
+
+    entry.hash_.store(hash, std::memory_order_relaxed);
+    entry.remaining_.store(remaining, std::memory_order_relaxed);
+    entry.lastPiece_.store(lastPiece, std::memory_order_relaxed);
+    entry.version_.store(version + 2, std::memory_order_release);
+}
+
+// Корень множества в системе непересекающихся множеств (со сжатием путей).
+static int FindRoot(PODVector<int>& parents, int index)
+{
+    while (parents[index] != index)
+    {
+        parents[index] = parents[parents[index]];
+        index = parents[index];
+    }
+
+    return index;
+}
+
+bool LevelSolver::Init(const LevelData& level)
+{
+    int numMolecules = level.GetNumMolecules();
+
+    // Ячейки сетки размером с дистанцию соседства, как при заливке.
+    SpatialGrid grid;
+    float gridExtent = level.containerRadius_ + FILL_NEIGHBOR_DISTANCE;
+    grid.Build(level.posX_.Buffer(), level.posY_.Buffer(), numMolecules, FILL_NEIGHBOR_DISTANCE,
+        -gridExtent, -gridExtent, gridExtent, gridExtent);
+
+    // Соседние молекулы одного цвета объединяются в области, а пары соседних
+    // молекул разного цвета запоминаются для построения графа областей.
+    PODVector<int> parents(numMolecules);
+    for (int i = 0; i < numMolecules; i++)
+        parents[i] = i;
+
+    PODVector<IntVector2> contacts;
+
+    for (int i = 0; i < numMolecules; i++)
+    {
+        int cellX = grid.GetCellX(level.posX_[i]);
+        int cellY = grid.GetCellY(level.posY_[i]);
+
+        for (int y = Max(cellY - 1, 0); y <= Min(cellY + 1, grid.GetHeight() - 1); y++)
+        {
+            for (int x = Max(cellX - 1, 0); x <= Min(cellX + 1, grid.GetWidth() - 1); x++)
+            {
+                int cell = grid.GetCellIndex(x, y);
+                const int* cellEnd = grid.GetCellEnd(cell);
+
+                for (const int* j = grid.GetCellBegin(cell); j != cellEnd; ++j)
+                {
+                    // Каждую пару обрабатываем один раз.
+                    if (*j <= i)
+                        continue;
+
+                    float dx = level.posX_[i] - level.posX_[*j];
+                    float dy = level.posY_[i] - level.posY_[*j];
+                    if (sqrtf(dx * dx + dy * dy) > FILL_NEIGHBOR_DISTANCE)
+                        continue;
+
+                    if (level.colors_[i] == level.colors_[*j])
+                        parents[FindRoot(parents, i)] = FindRoot(parents, *j);
+                    else
+                        contacts.Push(IntVector2(i, *j));
+                }
+            }
+        }
+    }
+
+    // Области нумеруются в порядке их первых молекул.
+    PODVector<int> moleculeRegions(numMolecules);
+    for (int i = 0; i < numMolecules; i++)
+        moleculeRegions[i] = -1;
+
+    numRegions_ = 0;
+    regionMolecules_.Clear();
+
+    for (int i = 0; i < numMolecules; i++)
+    {
+        int root = FindRoot(parents, i);
+
+        if (moleculeRegions[root] < 0)
+        {
+            moleculeRegions[root] = numRegions_++;
+            regionMolecules_.Push(i);
+        }
+
+        moleculeRegions[i] = moleculeRegions[root];
+    }
+
+    if (numRegions_ > SOLVER_MAX_REGIONS)
+    {
+        URHO3D_LOGERRORF("Level has %d regions, the solver supports up to %d", numRegions_, SOLVER_MAX_REGIONS);
+        return false;
+    }
+
+    adjacency_.Resize(numRegions_);
+    for (int i = 0; i < numRegions_; i++)
+        adjacency_[i].Clear();
+
+    for (const IntVector2& contact : contacts)
+    {
+        int regionA = moleculeRegions[contact.x_];
+        int regionB = moleculeRegions[contact.y_];
+        adjacency_[regionA].Set(regionB);
+        adjacency_[regionB].Set(regionA);
+    }
+
+    for (int color = 0; color < NUM_COLORS; color++)
+        initialState_.colors_[color].Clear();
+
+    for (int i = 0; i < numRegions_; i++)
+        initialState_.colors_[level.colors_[regionMolecules_[i]]].Set(i);
+
+    // Связные части графа областей.
+    regionPieces_.Resize(numRegions_);
+    for (int i = 0; i < numRegions_; i++)
+        regionPieces_[i] = -1;
+
+    numPieces_ = 0;
+
+    for (int i = 0; i < numRegions_; i++)
+    {
+        if (regionPieces_[i] >= 0)
+            continue;
+
+        RegionSet frontier;
+        frontier.Clear();
+        frontier.Set(i);
+
+        while (!frontier.Empty())
+        {
+            int region = frontier.PopFirst();
+            regionPieces_[region] = numPieces_;
+
+            RegionSet neighbors = adjacency_[region];
+            while (!neighbors.Empty())
+            {
+                int neighbor = neighbors.PopFirst();
+                if (regionPieces_[neighbor] < 0)
+                    frontier.Set(neighbor);
+            }
+        }
+
+        numPieces_++;
+    }
+
+    return true;
+}
+
+void LevelSolver::GetComponents(const SolverState& state, PODVector<Component>& components) const
+{
+    components.Clear();
+
+    for (int color = 0; color < NUM_COLORS; color++)
+    {
+        RegionSet remaining = state.colors_[color];
+
+        while (!remaining.Empty())
+        {
+            Component component;
+            component.regions_.Clear();
+            component.regions_.Set(remaining.First());
+            component.color_ = color;
+            component.piece_ = regionPieces_[remaining.First()];
+
+            // Добавляем соседние области того же цвета, пока они есть.
+            RegionSet frontier = component.regions_;
+            while (!frontier.Empty())
+            {
+                RegionSet next;
+                next.Clear();
+                while (!frontier.Empty())
+                    next |= adjacency_[frontier.PopFirst()];
+
+                next &= state.colors_[color];
+                next.Remove(component.regions_);
+                component.regions_ |= next;
+                frontier = next;
+            }
+
+            component.neighbors_.Clear();
+            RegionSet regions = component.regions_;
+            while (!regions.Empty())
+                component.neighbors_ |= adjacency_[regions.PopFirst()];
+            component.neighbors_.Remove(component.regions_);
+
+            components.Push(component);
+            remaining.Remove(component.regions_);
+        }
+    }
+}
+
+int LevelSolver::GetLowerBound(Worker& worker, const PODVector<Component>& components) const
+{
+    int numComponents = components.Size();
+
+    worker.pieceColors_.Resize(numPieces_);
+    worker.pieceDiameters_.Resize(numPieces_);
+    for (int i = 0; i < numPieces_; i++)
+    {
+        worker.pieceColors_[i] = 0;
+        worker.pieceDiameters_[i] = 0;
+    }
+
+    // Граф групп. Групп не больше, чем областей, поэтому для них подходит RegionSet.
+    worker.componentNeighbors_.Resize(numComponents);
+    for (int i = 0; i < numComponents; i++)
+        worker.componentNeighbors_[i].Clear();
+
+    unsigned colors = 0;
+
+    for (int i = 0; i < numComponents; i++)
+    {
+        colors |= 1u << components[i].color_;
+        worker.pieceColors_[components[i].piece_] |= 1u << components[i].color_;
+
+        for (int j = i + 1; j < numComponents; j++)
+        {
+            if (components[i].neighbors_.Intersects(components[j].regions_))
+            {
+                worker.componentNeighbors_[i].Set(j);
+                worker.componentNeighbors_[j].Set(i);
+            }
+        }
+    }
+
+    // Диаметр каждой части графа - наибольшее расстояние от группы до самой далекой от нее.
+    for (int i = 0; i < numComponents; i++)
+    {
+        RegionSet visited;
+        visited.Clear();
+        visited.Set(i);
+        RegionSet frontier = visited;
+        int eccentricity = 0;
+
+        for (;;)
+        {
+            RegionSet next;
+            next.Clear();
+            while (!frontier.Empty())
+                next |= worker.componentNeighbors_[frontier.PopFirst()];
+
+            next.Remove(visited);
+            if (next.Empty())
+                break;
+
+            visited |= next;
+            frontier = next;
+            eccentricity++;
+        }
+
+        int piece = components[i].piece_;
+        worker.pieceDiameters_[piece] = Max(worker.pieceDiameters_[piece], eccentricity);
+    }
+
+    // Ход меняет только одну часть графа. В ней он убирает не больше одного цвета
+    // и уменьшает диаметр не больше чем на 2.
+    int sum = 0;
+    for (int i = 0; i < numPieces_; i++)
+        sum += Max((worker.pieceDiameters_[i] + 1) / 2, (int)CountSetBits(worker.pieceColors_[i]) - 1);
+
+    return Max(sum, (int)CountSetBits(colors) - 1);
+}
+
+int LevelSolver::Search(Worker& worker, SolverState& state, int depth, int lastPiece)
+{
+    if (++worker.numNodes_ == SOLVER_NODE_BATCH)
+        FlushNodes(worker);
+
+    if (stop_.load(std::memory_order_relaxed))
+        return M_MAX_INT;
+
+    // Массив для своей глубины, чтобы рекурсивные вызовы его не перезаписали.
+    PODVector<Component>& components = worker.components_[depth];
+    GetComponents(state, components);
+
+    int estimate = depth + GetLowerBound(worker, components);
+    if (estimate > bound_)
+        return estimate;
+
+    // Нижняя оценка равна нулю, только если остался один цвет.
+    if (estimate == depth)
+    {
+        FoundSolution(worker, depth);
+        return depth;
+    }
+
+    int remaining = bound_ - depth;
+    unsigned long long hash = state.GetHash();
+    if (table_.Probe(state, hash, remaining, lastPiece))
+        return bound_ + 1;
+
+    int nextBound = M_MAX_INT;
+    bool searched = false;
+    bool donated = false;
+
+    for (unsigned i = 0; i < components.Size(); i++)
+    {
+        const Component& component = components[i];
+
+        // Ходы в разных частях графа перестановочны, поэтому перебираем только
+        // последовательности, в которых номера частей не убывают.
+        if (component.piece_ < lastPiece)
+            continue;
+
+        // Группа без соседей - это вся часть графа. Ее имеет смысл перекрашивать
+        // только в цвет, который есть в других частях.
+        bool alone = component.neighbors_.Empty();
+
+        for (int color = 0; color < NUM_COLORS; color++)
+        {
+            if (color == component.color_)
+                continue;
+
+            // Группу с соседями перекрашиваем только так, чтобы она с кем-то слилась.
+            if (alone ? state.colors_[color].Empty() : !component.neighbors_.Intersects(state.colors_[color]))
+                continue;
+
+            state.colors_[component.color_].Remove(component.regions_);
+            state.colors_[color] |= component.regions_;
+            worker.moves_[depth].molecule_ = regionMolecules_[component.regions_.First()];
+            worker.moves_[depth].color_ = color;
+
+            // Если другие потоки простаивают, то отдаем им ход. Первый ход всегда
+            // проверяем сами, чтобы не остаться без работы.
+            if (searched && remaining > SOLVER_MIN_DONATE_REMAINING
+                && numIdleWorkers_.load(std::memory_order_relaxed) > 0)
+            {
+                PushTask(state, depth + 1, component.piece_, worker.moves_);
+                donated = true;
+            }
+            else
+            {
+                nextBound = Min(nextBound, Search(worker, state, depth + 1, component.piece_));
+                searched = true;
+            }
+
+            state.colors_[color].Remove(component.regions_);
+            state.colors_[component.color_] |= component.regions_;
+
+            if (stop_.load(std::memory_order_relaxed))
+                return M_MAX_INT;
+        }
+    }
+
+    // Отданные ходы проверяются другими потоками, поэтому о состоянии ничего не известно.
+    if (!donated)
+        table_.Store(state, hash, remaining, lastPiece);
+
+    return nextBound;
+}
+
+void LevelSolver::FlushNodes(Worker& worker)
+{
+    unsigned numNodes = numNodes_.fetch_add(worker.numNodes_, std::memory_order_relaxed) + worker.numNodes_;
+    worker.numNodes_ = 0;
+
+    if (numNodes > maxNodes_)
+    {
+        aborted_ = true;
+        stop_ = true;
+    }
+}
+
+void LevelSolver::FoundSolution(const Worker& worker, int depth)
+{
+    // Все решения на одной итерации одинаковой длины, берем первое.
+    bool expected = false;
+    if (found_.compare_exchange_strong(expected, true))
+    {
+        solution_ = worker.moves_;
+        solution_.Resize(depth);
+    }
+
+    stop_ = true;
+}
+
+void LevelSolver::PushTask(const SolverState& state, int depth, int lastPiece, const PODVector<SolverMove>& moves)
+{
+    Task task;
+    task.state_ = state;
+    task.depth_ = depth;
+    task.lastPiece_ = lastPiece;
+    task.moves_.Resize(depth);
+    for (int i = 0; i < depth; i++)
+        task.moves_[i] = moves[i];
+
+    // Счетчик увеличивается раньше, чем закончится задача, которая отдала эту.
+    numPendingTasks_.fetch_add(1);
+
+    MutexLock lock(tasksMutex_);
+    tasks_.Push(task);
+    numQueuedTasks_.store(tasks_.Size(), std::memory_order_relaxed);
+}
+
+bool LevelSolver::PopTask(Task& task)
+{
+    if (numQueuedTasks_.load(std::memory_order_relaxed) == 0)
+        return false;
+
+    MutexLock lock(tasksMutex_);
+    if (tasks_.Empty())
+        return false;
+
+    // Берем самую старую задачу: она ближе к корню, и ее поддерево больше.
+    task = tasks_.Front();
+    tasks_.PopFront();
+    numQueuedTasks_.store(tasks_.Size(), std::memory_order_relaxed);
+    return true;
+}
+
+void LevelSolver::RunWorker(Worker& worker)
+{
+    Task task;
+
+    for (;;)
+    {
+        if (PopTask(task))
+        {
+            for (int i = 0; i < task.depth_; i++)
+                worker.moves_[i] = task.moves_[i];
+
+            int nextBound = Search(worker, task.state_, task.depth_, task.lastPiece_);
+
+            int prevBound = nextBound_.load(std::memory_order_relaxed);
+            while (nextBound < prevBound && !nextBound_.compare_exchange_weak(prevBound, nextBound))
+            {
+            }
+
+            numPendingTasks_.fetch_sub(1);
+            continue;
+        }
+
+        if (numPendingTasks_.load() == 0 || stop_.load())
+            break;
+
+        // Задач нет, но другие потоки еще работают. Ждем, пока они чем-нибудь поделятся.
+        numIdleWorkers_.fetch_add(1);
+        while (numPendingTasks_.load() > 0 && !stop_.load(std::memory_order_relaxed)
+            && numQueuedTasks_.load(std::memory_order_relaxed) == 0)
+            std::this_thread::yield();
+        numIdleWorkers_.fetch_sub(1);
+    }
+
+    FlushNodes(worker);
+    numActiveWorkers_.fetch_sub(1, std::memory_order_release);
+}
+
+void LevelSolver::SearchWork(const WorkItem* item, unsigned threadIndex)
+{
+    LevelSolver* solver = static_cast<LevelSolver*>(item->aux_);
+    solver->RunWorker(*static_cast<Worker*>(item->start_));
+}
+
+LevelSolver::~LevelSolver()
+{
+    Cancel();
+}
+
+void LevelSolver::Start(WorkQueue* workQueue, unsigned maxNodes)
+{
+    Cancel();
+
+    workQueue_ = workQueue;
+    maxNodes_ = maxNodes;
+    numNodes_ = 0;
+    found_ = false;
+    aborted_ = false;
+    result_ = SolverResult();
+    table_.SetSize(DEFAULT_SOLVER_TABLE_SIZE);
+
+    // Основной поток в поиске не участвует. Один рабочий поток оставляем свободным, чтобы
+    // фоновая загрузка уровней не ждала конца итерации поиска.
+    workers_.Resize(Max(workQueue_->GetNumThreads(), 2u) - 1);
+
+    // Первое ограничение - нижняя оценка для начального состояния.
+    Worker& worker = workers_[0];
+    worker.components_.Resize(1);
+    GetComponents(initialState_, worker.components_[0]);
+    bound_ = GetLowerBound(worker, worker.components_[0]);
+
+    running_ = true;
+    StartIteration();
+}
+
+void LevelSolver::StartIteration()
+{
+    for (Worker& worker : workers_)
+    {
+        worker.components_.Resize(bound_ + 1);
+        worker.moves_.Resize(bound_ + 1);
+        worker.numNodes_ = 0;
+    }
+
+    stop_ = false;
+    nextBound_ = M_MAX_INT;
+    numIdleWorkers_ = 0;
+    numActiveWorkers_ = workers_.Size();
+
+    // Поиск начинается с одной задачи. Остальные потоки получат работу, когда
+    // первый поделится с ними ходами.
+    tasks_.Clear();
+    numQueuedTasks_ = 0;
+    numPendingTasks_ = 0;
+    PushTask(initialState_, 0, 0, workers_[0].moves_);
+
+    if (workQueue_->GetNumThreads() == 0)
+    {
+        RunWorker(workers_[0]);
+        return;
+    }
+
+    // Приоритет ниже, чем у задач физики и загрузки уровней: WorkQueue::Complete(p)
+    // выполняет и дожидается всех задач с приоритетом не ниже p, а ContainerLogic
+    // и LevelLoader не должны дожидаться поиска.
+    for (Worker& worker : workers_)
+    {
+        SharedPtr<WorkItem> item = workQueue_->GetFreeItem();
+        item->priority_ = SOLVER_PRIORITY;
+        item->workFunction_ = SearchWork;
+        item->aux_ = this;
+        item->start_ = &worker;
+        workQueue_->AddWorkItem(item);
+    }
+}
+
+bool LevelSolver::Update()
+{
+    if (!running_)
+        return true;
+
+    if (numActiveWorkers_.load(std::memory_order_acquire) > 0)
+        return false;
+
+    if (found_)
+    {
+        result_.minTurns_ = result_.lowerBound_ = solution_.Size();
+        result_.moves_ = solution_;
+        Finish();
+        return true;
+    }
+
+    // Если отсеченных состояний нет, то ходов не осталось (такого быть не должно).
+    if (aborted_ || nextBound_ == M_MAX_INT)
+    {
+        result_.lowerBound_ = bound_;
+        Finish();
+        return true;
+    }
+
+    // Таблица транспозиций сохраняется между итерациями.
+    bound_ = nextBound_;
+    StartIteration();
+    return false;
+}
+
+void LevelSolver::Finish()
+{
+    running_ = false;
+    result_.numNodes_ = Min(numNodes_.load(), maxNodes_);
+}
+
+void LevelSolver::Cancel()
+{
+    if (!running_)
+        return;
+
+    // Задачи, которые еще не начались, сразу закончатся. Complete() не подходит:
+    // он дождался бы и всех остальных задач очереди (например, загрузки уровней).
+    stop_ = true;
+    while (numActiveWorkers_.load(std::memory_order_acquire) > 0)
+        std::this_thread::yield();
+    running_ = false;
+}
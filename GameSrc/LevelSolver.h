@@ -0,0 +1,257 @@
+/*
+Поиск минимального числа ходов для прохождения уровня.
+Молекулы одного цвета, соединенные цепочкой соседей (по тому же правилу, что и при заливке),
+образуют область. Ход перекрашивает область целиком, и она сливается с соседними
+областями нового цвета. Уровень пройден, когда у всех молекул один цвет.
+
+Поиск - IDA* по состояниям, где состояние - множество исходных областей каждого цвета
+(битовые массивы). Нижняя оценка числа оставшихся ходов учитывает число цветов и диаметр
+графа областей: ход стягивает область с соседями, поэтому диаметр уменьшается не больше
+чем на 2. Уже просмотренные состояния запоминаются в таблице транспозиций.
+
+Поиск идет в рабочих потоках WorkQueue, основной поток только запускает итерации
+(см. Update()), поэтому редактор не зависает. Каждый поток обходит свое поддерево.
+Если какой-то поток простаивает, занятые потоки отдают ему непроверенные ходы через
+общий список задач. Таблица транспозиций общая для всех потоков и работает без блокировок.
+
+Решатель работает с неподвижными молекулами. В игре молекулы двигаются, и области
+могут сливаться и распадаться, поэтому результат - оценка для дизайнера уровня.
+*/
+
+#pragma once
+#include "LevelFile.h"
+#include "ContainerLogic.h"
+#include <atomic>
+
+// Максимальное число областей в уровне.
+#define SOLVER_MAX_REGIONS 128
+// Ограничение числа просмотренных состояний по умолчанию.
+#define DEFAULT_SOLVER_MAX_NODES 20000000
+// Размер таблицы транспозиций по умолчанию (число записей, степень двойки).
+#define DEFAULT_SOLVER_TABLE_SIZE (1 << 16)
+// Число состояний, после которого поток добавляет их к общему счетчику и проверяет, не пора ли остановиться.
+#define SOLVER_NODE_BATCH 1024
+// Поток отдает ход простаивающим потокам, только если после хода остается не меньше
+// стольких ходов. Иначе поддерево слишком маленькое и его дешевле проверить самому.
+#define SOLVER_MIN_DONATE_REMAINING 3
+// Приоритет задач поиска в WorkQueue. Самый низкий, ниже загрузки уровней (см. LevelLoader.h).
+#define SOLVER_PRIORITY 0
+
+// Множество областей.
+struct RegionSet
+{
+    static const int NUM_WORDS = SOLVER_MAX_REGIONS / 64;
+    unsigned long long words_[NUM_WORDS];
+
+    void Clear();
+    void Set(int index) { words_[index >> 6] |= 1ull << (index & 63); }
+    bool Test(int index) const { return (words_[index >> 6] & (1ull << (index & 63))) != 0; }
+    bool Empty() const;
+    bool Intersects(const RegionSet& rhs) const;
+    // Номер первой области. Множество не должно быть пустым.
+    int First() const;
+    // Удаляет первую область и возвращает ее номер. Множество не должно быть пустым.
+    int PopFirst();
+    // Удаляет области, которые есть в rhs.
+    void Remove(const RegionSet& rhs);
+
+    RegionSet& operator |=(const RegionSet& rhs);
+    RegionSet& operator &=(const RegionSet& rhs);
+};
+
+// Состояние уровня при поиске: области каждого цвета.
+struct SolverState
+{
+    RegionSet colors_[NUM_COLORS];
+
+    unsigned long long GetHash() const;
+    bool operator ==(const SolverState& rhs) const;
+};
+
+// Ход: заливка цветом color_, начиная с молекулы molecule_.
+struct SolverMove
+{
+    int molecule_;
+    int color_;
+};
+
+struct SolverResult
+{
+    // Минимальное число ходов. Если -1, то поиск прерван из-за ограничения числа состояний.
+    int minTurns_ = -1;
+    // Нижняя оценка числа ходов (если решение найдено, то равна minTurns_).
+    int lowerBound_ = 0;
+    // Число просмотренных состояний.
+    unsigned numNodes_ = 0;
+    // Последовательность ходов минимальной длины.
+    PODVector<SolverMove> moves_;
+};
+
+// Таблица транспозиций. Хранит для состояния число ходов, которого заведомо не хватает
+// для прохождения уровня. При коллизии старая запись заменяется.
+// Probe() и Store() можно вызывать из разных потоков одновременно. Каждая запись защищена
+// счетчиком версий: пока запись изменяется, он нечетный, и читатель ее игнорирует.
+// Если два потока пишут в одну запись, то запись второго пропускается.
+class TranspositionTable
+{
+public:
+    // Размер должен быть степенью двойки.
+    void SetSize(unsigned size);
+    // Нельзя вызывать во время поиска.
+    void Clear();
+    // Возвращает true, если из состояния нельзя пройти уровень за remaining ходов.
+    bool Probe(const SolverState& state, unsigned long long hash, int remaining, int lastPiece) const;
+    // Запоминает, что из состояния нельзя пройти уровень за remaining ходов.
+    void Store(const SolverState& state, unsigned long long hash, int remaining, int lastPiece);
+
+private:
+    static const int NUM_STATE_WORDS = NUM_COLORS * RegionSet::NUM_WORDS;
+
+    struct Entry
+    {
+        std::atomic<unsigned> version_;
+        std::atomic<unsigned long long> words_[NUM_STATE_WORDS];
+        std::atomic<unsigned long long> hash_;
+        // Число ходов, которого не хватает. Если -1, то запись пустая.
+        std::atomic<int> remaining_;
+        // Ограничение на ходы, при котором проверялось состояние (см. LevelSolver::Search()).
+        std::atomic<int> lastPiece_;
+    };
+
+    SharedArrayPtr<Entry> entries_;
+    unsigned size_ = 0;
+
+    // Слово состояния по сквозному номеру.
+    static unsigned long long GetStateWord(const SolverState& state, int index)
+    {
+        return state.colors_[index / RegionSet::NUM_WORDS].words_[index % RegionSet::NUM_WORDS];
+    }
+};
+
+class LevelSolver
+{
+public:
+    // Останавливает поиск, если он еще идет.
+    ~LevelSolver();
+
+    // Строит граф областей по состоянию ёмкости. Возвращает false, если областей слишком много.
+    // Нельзя вызывать во время поиска.
+    bool Init(const LevelData& level);
+    // Запускает поиск минимального числа ходов и сразу возвращает управление. Поиск
+    // прерывается после maxNodes просмотренных состояний. Если у WorkQueue нет рабочих
+    // потоков, то поиск идет в основном потоке внутри Update().
+    void Start(WorkQueue* workQueue, unsigned maxNodes = DEFAULT_SOLVER_MAX_NODES);
+    // Вызывается из основного потока каждый кадр: когда итерация поиска закончена,
+    // запускает следующую. Возвращает true, если поиск закончен (см. GetResult()).
+    bool Update();
+    // Прерывает поиск и дожидается рабочих потоков.
+    void Cancel();
+
+    bool IsRunning() const { return running_; }
+    int GetNumRegions() const { return numRegions_; }
+    // Число ходов, которое проверяется на текущей итерации.
+    int GetBound() const { return bound_; }
+    // Число просмотренных состояний (обновляется с задержкой).
+    unsigned GetNumNodes() const { return numNodes_.load(std::memory_order_relaxed); }
+    const SolverResult& GetResult() const { return result_; }
+
+private:
+    // Связная группа областей одного цвета в текущем состоянии.
+    struct Component
+    {
+        RegionSet regions_;
+        // Соседние области другого цвета.
+        RegionSet neighbors_;
+        int color_;
+        // Связная часть графа областей, в которую входит группа.
+        int piece_;
+    };
+
+    // Поддерево поиска: состояние и ходы, которые к нему привели.
+    struct Task
+    {
+        SolverState state_;
+        int depth_;
+        int lastPiece_;
+        PODVector<SolverMove> moves_;
+    };
+
+    // Данные одного рабочего потока.
+    struct Worker
+    {
+        // Группы для каждой глубины поиска.
+        Vector<PODVector<Component> > components_;
+        // Текущая последовательность ходов.
+        PODVector<SolverMove> moves_;
+        // Временные массивы для нижней оценки.
+        PODVector<RegionSet> componentNeighbors_;
+        PODVector<unsigned> pieceColors_;
+        PODVector<int> pieceDiameters_;
+        // Состояния, еще не добавленные к общему счетчику.
+        unsigned numNodes_ = 0;
+    };
+
+    int numRegions_ = 0;
+    // Для каждой области - соседние области.
+    PODVector<RegionSet> adjacency_;
+    // Первая молекула каждой области (для описания ходов).
+    PODVector<int> regionMolecules_;
+    // Связные части графа областей. Ходы в разных частях не влияют друг на друга.
+    PODVector<int> regionPieces_;
+    int numPieces_ = 0;
+    SolverState initialState_;
+
+    // Состояние поиска. Ограничение bound_ меняется только между итерациями,
+    // когда рабочие потоки не запущены.
+    WorkQueue* workQueue_ = nullptr;
+    bool running_ = false;
+    unsigned maxNodes_ = 0;
+    int bound_ = 0;
+    SolverResult result_;
+    Vector<Worker> workers_;
+    TranspositionTable table_;
+
+    // Общие данные рабочих потоков.
+    std::atomic<unsigned> numNodes_{ 0 };
+    // Минимальная оценка среди отсеченных состояний (ограничение для следующей итерации).
+    std::atomic<int> nextBound_{ 0 };
+    // Найдено решение.
+    std::atomic<bool> found_{ false };
+    // Превышено ограничение числа состояний.
+    std::atomic<bool> aborted_{ false };
+    // Потоки должны закончить работу.
+    std::atomic<bool> stop_{ false };
+    // Число потоков, которые еще не закончили итерацию.
+    std::atomic<int> numActiveWorkers_{ 0 };
+    // Число потоков, которые ждут задач.
+    std::atomic<int> numIdleWorkers_{ 0 };
+    // Число задач в списке и выполняемых.
+    std::atomic<int> numPendingTasks_{ 0 };
+    // Число задач в списке (чтобы проверять его без блокировки).
+    std::atomic<int> numQueuedTasks_{ 0 };
+    Mutex tasksMutex_;
+    List<Task> tasks_;
+    PODVector<SolverMove> solution_;
+
+    // Запускает итерацию поиска с ограничением bound_.
+    void StartIteration();
+    // Заканчивает поиск и заполняет result_.
+    void Finish();
+    // Функция для WorkQueue.
+    static void SearchWork(const WorkItem* item, unsigned threadIndex);
+    // Выполняет задачи из общего списка, пока они не кончатся во всех потоках.
+    void RunWorker(Worker& worker);
+    void PushTask(const SolverState& state, int depth, int lastPiece, const PODVector<SolverMove>& moves);
+    bool PopTask(Task& task);
+    // Добавляет состояния, просмотренные потоком, к общему счетчику.
+    void FlushNodes(Worker& worker);
+    // Запоминает решение, если оно найдено первым, и останавливает поиск.
+    void FoundSolution(const Worker& worker, int depth);
+    // Разбивает состояние на связные группы областей одного цвета.
+    void GetComponents(const SolverState& state, PODVector<Component>& components) const;
+    // Нижняя оценка числа ходов до прохождения уровня.
+    int GetLowerBound(Worker& worker, const PODVector<Component>& components) const;
+    // Поиск с ограничением bound_ на общее число ходов. Возвращает минимальную оценку
+    // среди отсеченных состояний.
+    int Search(Worker& worker, SolverState& state, int depth, int lastPiece);
+};
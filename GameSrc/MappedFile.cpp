@@ -0,0 +1,109 @@
+#include "MappedFile.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::~MappedFile()
+{
+    Close();
+}
+
+#ifdef _WIN32
+
+bool MappedFile::Open(const String& fileName)
+{
+    Close();
+
+    fileHandle_ = CreateFileW(WString(GetNativePath(fileName)).CString(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+        OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (fileHandle_ == INVALID_HANDLE_VALUE)
+    {
+        fileHandle_ = nullptr;
+        return false;
+    }
+
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(fileHandle_, &fileSize) || fileSize.QuadPart == 0 || fileSize.QuadPart > M_MAX_INT)
+    {
+        Close();
+        return false;
+    }
+
+    mappingHandle_ = CreateFileMappingW(fileHandle_, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (!mappingHandle_)
+    {
+        Close();
+        return false;
+    }
+
+    data_ = static_cast<const unsigned char*>(MapViewOfFile(mappingHandle_, FILE_MAP_READ, 0, 0, 0));
+    if (!data_)
+    {
+        Close();
+        return false;
+    }
+
+    size_ = (unsigned)fileSize.QuadPart;
+    return true;
+}
+
+void MappedFile::Close()
+{
+    if (data_)
+        UnmapViewOfFile(data_);
+    if (mappingHandle_)
+        CloseHandle(mappingHandle_);
+    if (fileHandle_)
+        CloseHandle(fileHandle_);
+
+    data_ = nullptr;
+    size_ = 0;
+    mappingHandle_ = nullptr;
+    fileHandle_ = nullptr;
+}
+
+#else
+
+bool MappedFile::Open(const String& fileName)
+{
+    Close();
+
+    int fd = open(GetNativePath(fileName).CString(), O_RDONLY);
+    if (fd == -1)
+        return false;
+
+    struct stat fileStat;
+    if (fstat(fd, &fileStat) == -1 || fileStat.st_size == 0 || fileStat.st_size > M_MAX_INT)
+    {
+        close(fd);
+        return false;
+    }
+
+    void* data = mmap(nullptr, (size_t)fileStat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    // Отображение остается действительным и после закрытия дескриптора.
+    close(fd);
+
+    if (data == MAP_FAILED)
+        return false;
+
+    data_ = static_cast<const unsigned char*>(data);
+    size_ = (unsigned)fileStat.st_size;
+    return true;
+}
+
+void MappedFile::Close()
+{
+    if (data_)
+        munmap(const_cast<unsigned char*>(data_), size_);
+
+    data_ = nullptr;
+    size_ = 0;
+}
+
+#endif
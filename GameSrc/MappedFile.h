@@ -0,0 +1,35 @@
+/*
+Файл, отображенный в память только для чтения.
+Данные файла доступны как обычный массив без копирования, а страницы
+подгружаются операционной системой по мере обращения к ним.
+*/
+
+#pragma once
+#include <Urho3D/Urho3DAll.h>
+
+class MappedFile
+{
+public:
+    MappedFile() = default;
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator =(const MappedFile&) = delete;
+
+    // Отображает файл в память. Предыдущий файл закрывается.
+    bool Open(const String& fileName);
+    void Close();
+
+    bool IsOpen() const { return data_ != nullptr; }
+    const unsigned char* GetData() const { return data_; }
+    unsigned GetSize() const { return size_; }
+
+private:
+    const unsigned char* data_ = nullptr;
+    unsigned size_ = 0;
+
+#ifdef _WIN32
+    void* fileHandle_ = nullptr;
+    void* mappingHandle_ = nullptr;
+#endif
+};
@@ -0,0 +1,188 @@
+#include "MoleculeGroup.h"
+
+MoleculeGroup::MoleculeGroup(Context* context) :
+    Drawable(context, DRAWABLE_GEOMETRY)
+{
+}
+
+void MoleculeGroup::RegisterObject(Context* context)
+{
+    context->RegisterFactory<MoleculeGroup>();
+}
+
+void MoleculeGroup::SetModel(Model* model)
+{
+    model_ = model;
+    boundingBox_ = model ? model->GetBoundingBox() : BoundingBox();
+    UpdateSourceBatches();
+}
+
+void MoleculeGroup::SetColorMaterial(int color, Material* material)
+{
+    if (color >= (int)materials_.Size())
+        materials_.Resize(color + 1);
+
+    materials_[color] = material;
+}
+
+void MoleculeGroup::UpdateMolecules(const float* prevPosX, const float* prevPosY, const float* posX, const float* posY,
+    const int* colors, int numMolecules, float alpha)
+{
+    if (!node_)
+        return;
+
+    const Matrix3x4& nodeTransform = node_->GetWorldTransform();
+    int numColors = materials_.Size();
+
+    // Сортируем молекулы по цвету подсчетом, чтобы трансформации молекул
+    // одного цвета шли подряд и их можно было отдать в одну пачку.
+    colorStart_.Resize(numColors + 1);
+    for (int i = 0; i <= numColors; i++)
+        colorStart_[i] = 0;
+
+    for (int i = 0; i < numMolecules; i++)
+        colorStart_[colors[i] + 1]++;
+
+    for (int i = 0; i < numColors; i++)
+        colorStart_[i + 1] += colorStart_[i];
+
+    colorFill_.Resize(numColors);
+    for (int i = 0; i < numColors; i++)
+        colorFill_[i] = colorStart_[i];
+
+    worldTransforms_.Resize(numMolecules);
+    instanceMolecules_.Resize(numMolecules);
+
+    for (int i = 0; i < numMolecules; i++)
+    {
+        float x = Lerp(prevPosX[i], posX[i], alpha);
+        float y = Lerp(prevPosY[i], posY[i], alpha);
+        int instance = colorFill_[colors[i]]++;
+        worldTransforms_[instance] = nodeTransform * Matrix3x4(Vector3(x, y, 0.0f), Quaternion::IDENTITY, 1.0f);
+        instanceMolecules_[instance] = i;
+    }
+
+    UpdateSourceBatches();
+
+    // Рамка изменилась, нужно переместить компонент в октодереве.
+    OnMarkedDirty(node_);
+}
+
+void MoleculeGroup::UpdateSourceBatches()
+{
+    batches_.Clear();
+
+    if (!model_)
+        return;
+
+    // Пустые цвета пропускаем, чтобы не было пачек без трансформаций.
+    for (unsigned color = 0; color < materials_.Size(); color++)
+    {
+        if (color + 1 >= colorStart_.Size())
+            break;
+
+        int numInstances = colorStart_[color + 1] - colorStart_[color];
+        if (numInstances == 0)
+            continue;
+
+        for (unsigned i = 0; i < model_->GetNumGeometries(); i++)
+        {
+            SourceBatch batch;
+            batch.geometry_ = model_->GetGeometry(i, 0);
+            batch.material_ = materials_[color];
+            batch.worldTransform_ = &worldTransforms_[colorStart_[color]];
+            batch.numWorldTransforms_ = numInstances;
+            batch.geometryType_ = GEOM_STATIC;
+            batches_.Push(batch);
+        }
+    }
+}
+
+void MoleculeGroup::UpdateBatches(const FrameInfo& frame)
+{
+    // Трансформации уже записаны в пачки в UpdateMolecules(), осталось только
+    // расстояние до камеры для сортировки.
+    distance_ = frame.camera_->GetDistance(GetWorldBoundingBox().Center());
+
+    for (unsigned i = 0; i < batches_.Size(); i++)
+        batches_[i].distance_ = distance_;
+}
+
+void MoleculeGroup::OnWorldBoundingBoxUpdate()
+{
+    worldBoundingBox_.Clear();
+
+    if (!model_ || worldTransforms_.Empty())
+        return;
+
+    // Молекулы отличаются только смещением, поэтому рамки у всех молекул
+    // одинакового размера. Вычисляем ее один раз.
+    BoundingBox instanceBox = model_->GetBoundingBox().Transformed(worldTransforms_[0]);
+    Vector3 minOffset = instanceBox.min_ - worldTransforms_[0].Translation();
+    Vector3 maxOffset = instanceBox.max_ - worldTransforms_[0].Translation();
+
+    for (unsigned i = 0; i < worldTransforms_.Size(); i++)
+    {
+        Vector3 center = worldTransforms_[i].Translation();
+        worldBoundingBox_.Merge(BoundingBox(center + minOffset, center + maxOffset));
+    }
+}
+
+void MoleculeGroup::ProcessRayQuery(const RayOctreeQuery& query, PODVector<RayQueryResult>& results)
+{
+    if (!model_)
+        return;
+
+    // GetWorldBoundingBox() заодно обновляет рамку, если она устарела.
+    if (query.ray_.HitDistance(GetWorldBoundingBox()) >= query.maxDistance_)
+        return;
+
+    const BoundingBox& modelBox = model_->GetBoundingBox();
+
+    for (unsigned i = 0; i < worldTransforms_.Size(); i++)
+    {
+        // Сначала грубая проверка с рамкой молекулы.
+        float distance = query.ray_.HitDistance(modelBox.Transformed(worldTransforms_[i]));
+        Vector3 normal = -query.ray_.direction_;
+
+        // Затем более точные проверки, если они нужны.
+        if (query.level_ >= RAY_OBB && distance < query.maxDistance_)
+        {
+            Matrix3x4 inverse = worldTransforms_[i].Inverse();
+            Ray localRay = query.ray_.Transformed(inverse);
+            distance = localRay.HitDistance(modelBox);
+
+            if (query.level_ >= RAY_TRIANGLE && distance < query.maxDistance_)
+            {
+                distance = M_INFINITY;
+
+                for (unsigned j = 0; j < model_->GetNumGeometries(); j++)
+                {
+                    Geometry* geometry = model_->GetGeometry(j, 0);
+                    if (!geometry)
+                        continue;
+
+                    Vector3 geometryNormal;
+                    float geometryDistance = geometry->GetHitDistance(localRay, &geometryNormal);
+                    if (geometryDistance < distance)
+                    {
+                        distance = geometryDistance;
+                        normal = (worldTransforms_[i] * Vector4(geometryNormal, 0.0f)).Normalized();
+                    }
+                }
+            }
+        }
+
+        if (distance < query.maxDistance_)
+        {
+            RayQueryResult result;
+            result.position_ = query.ray_.origin_ + distance * query.ray_.direction_;
+            result.normal_ = normal;
+            result.distance_ = distance;
+            result.drawable_ = this;
+            result.node_ = node_;
+            result.subObject_ = instanceMolecules_[i];
+            results.Push(result);
+        }
+    }
+}
@@ -0,0 +1,54 @@
+/*
+Отрисовка всех молекул ёмкости одним компонентом.
+Вместо отдельной ноды и StaticModel на каждую молекулу используется один Drawable,
+в котором молекулы одного цвета собраны в одну пачку с несколькими трансформациями
+(как в StaticModelGroup). Если видеокарта поддерживает инстансинг, то каждый цвет
+рисуется за один вызов отрисовки.
+*/
+
+#pragma once
+#include <Urho3D/Urho3DAll.h>
+
+class MoleculeGroup : public Drawable
+{
+    URHO3D_OBJECT(MoleculeGroup, Drawable);
+
+public:
+    MoleculeGroup(Context* context);
+    static void RegisterObject(Context* context);
+
+    // Луч проверяется с каждой молекулой. В subObject_ результата записывается индекс молекулы.
+    virtual void ProcessRayQuery(const RayOctreeQuery& query, PODVector<RayQueryResult>& results);
+    virtual void UpdateBatches(const FrameInfo& frame);
+
+    // Модель молекулы.
+    void SetModel(Model* model);
+    // Материал для молекул определенного цвета.
+    void SetColorMaterial(int color, Material* material);
+
+    // Обновляет трансформации молекул. Позиции интерполируются между предыдущим
+    // и текущим шагом физики: alpha = 0 - предыдущий шаг, alpha = 1 - текущий.
+    // Позиции задаются в локальных координатах ноды.
+    void UpdateMolecules(const float* prevPosX, const float* prevPosY, const float* posX, const float* posY,
+        const int* colors, int numMolecules, float alpha);
+
+protected:
+    virtual void OnWorldBoundingBoxUpdate();
+
+private:
+    SharedPtr<Model> model_;
+    // Материалы для каждого цвета.
+    Vector<SharedPtr<Material> > materials_;
+    // Мировые трансформации молекул, отсортированные по цвету.
+    PODVector<Matrix3x4> worldTransforms_;
+    // Индекс молекулы для каждой трансформации.
+    PODVector<int> instanceMolecules_;
+    // Для каждого цвета смещение его первой трансформации в worldTransforms_.
+    // Последний элемент равен общему числу молекул.
+    PODVector<int> colorStart_;
+    // Счетчики заполнения при сортировке по цвету.
+    PODVector<int> colorFill_;
+
+    // Пересоздает пачки по одной на каждую пару (цвет, геометрия модели).
+    void UpdateSourceBatches();
+};
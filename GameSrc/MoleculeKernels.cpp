@@ -0,0 +1,378 @@
+#include "MoleculeKernels.h"
+#include <Urho3D/Urho3DAll.h>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+    #define KERNELS_X86
+    #include <immintrin.h>
+    #ifdef _MSC_VER
+        #include <intrin.h>
+    #endif
+
+    // На x86-64 SSE есть всегда, на 32-битном x86 он должен быть включен флагами компилятора.
+    #if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+        #define KERNELS_SSE
+    #endif
+
+    // AVX-функции компилируются с отдельным набором инструкций, а вызываются
+    // только если процессор их поддерживает.
+    #ifdef _MSC_VER
+        #define AVX_TARGET
+    #else
+        #define AVX_TARGET __attribute__((target("avx")))
+    #endif
+    #define KERNELS_AVX
+#endif
+
+#if defined(__aarch64__) || defined(_M_ARM64)
+    #define KERNELS_NEON
+    #include <arm_neon.h>
+#endif
+
+// Молекулы, расстояние между которыми не больше этого значения, считаются совпадающими
+// (так же, как при проверке Equals(distance, 0.0f)).
+static const float COINCIDENCE_DISTANCE = M_EPSILON;
+
+// Складывает дорожки в фиксированном порядке. Векторные реализации повторяют этот порядок:
+// сначала дорожка l складывается с дорожкой l + 4, затем 0-я с 2-й и 1-я с 3-й, и в конце
+// два оставшихся значения.
+static float ReduceLanes(const float* lanes)
+{
+    float r0 = lanes[0] + lanes[4];
+    float r1 = lanes[1] + lanes[5];
+    float r2 = lanes[2] + lanes[6];
+    float r3 = lanes[3] + lanes[7];
+    float s0 = r0 + r2;
+    float s1 = r1 + r3;
+    return s0 + s1;
+}
+
+static bool ComputeRepulsionScalar(const RepulsionParams& params, float x, float y, float color, float id,
+    const NeighborBatch& neighbors, float& forceX, float& forceY)
+{
+    float accX[FORCE_KERNEL_WIDTH] = {};
+    float accY[FORCE_KERNEL_WIDTH] = {};
+    bool coincident = false;
+
+    for (int k = 0; k < neighbors.size_; k++)
+    {
+        int lane = k % FORCE_KERNEL_WIDTH;
+
+        // Вектор от молекулы до соседа и расстояние между ними.
+        float dx = neighbors.x_[k] - x;
+        float dy = neighbors.y_[k] - y;
+        float distance = sqrtf(dx * dx + dy * dy);
+
+        bool other = neighbors.id_[k] != id;
+        bool tooClose = distance <= COINCIDENCE_DISTANCE;
+        bool interacts = other && !tooClose && distance < params.range_;
+
+        if (other && tooClose)
+            coincident = true;
+
+        // Кубический закон отталкивания. Значение считается и для невзаимодействующих
+        // соседей (так же, как в векторных реализациях), но затем отбрасывается.
+        float forceModulus = 1.0f - distance / params.range_;
+        forceModulus = forceModulus * forceModulus * forceModulus;
+        forceModulus = forceModulus * params.strength_;
+        forceModulus = forceModulus * (neighbors.color_[k] != color ? params.mismatchFactor_ : 1.0f);
+
+        float neighborForceX = forceModulus * (dx / distance);
+        float neighborForceY = forceModulus * (dy / distance);
+
+        accX[lane] -= interacts ? neighborForceX : 0.0f;
+        accY[lane] -= interacts ? neighborForceY : 0.0f;
+    }
+
+    forceX = ReduceLanes(accX);
+    forceY = ReduceLanes(accY);
+    return coincident;
+}
+
+#ifdef KERNELS_SSE
+// Обрабатывает 4 соседа, начиная с k.
+static inline void RepulsionSSE4(const RepulsionParams& params, __m128 x, __m128 y, __m128 color, __m128 id,
+    const NeighborBatch& neighbors, int k, __m128& accX, __m128& accY, __m128& coincident)
+{
+    __m128 range = _mm_set1_ps(params.range_);
+    __m128 one = _mm_set1_ps(1.0f);
+
+    __m128 dx = _mm_sub_ps(_mm_loadu_ps(neighbors.x_ + k), x);
+    __m128 dy = _mm_sub_ps(_mm_loadu_ps(neighbors.y_ + k), y);
+    __m128 distance = _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)));
+
+    __m128 other = _mm_cmpneq_ps(_mm_loadu_ps(neighbors.id_ + k), id);
+    __m128 tooClose = _mm_cmple_ps(distance, _mm_set1_ps(COINCIDENCE_DISTANCE));
+    __m128 interacts = _mm_andnot_ps(tooClose, _mm_and_ps(other, _mm_cmplt_ps(distance, range)));
+    coincident = _mm_or_ps(coincident, _mm_and_ps(other, tooClose));
+
+    __m128 forceModulus = _mm_sub_ps(one, _mm_div_ps(distance, range));
+    forceModulus = _mm_mul_ps(_mm_mul_ps(forceModulus, forceModulus), forceModulus);
+    forceModulus = _mm_mul_ps(forceModulus, _mm_set1_ps(params.strength_));
+    __m128 mismatch = _mm_cmpneq_ps(_mm_loadu_ps(neighbors.color_ + k), color);
+    __m128 factor = _mm_or_ps(_mm_and_ps(mismatch, _mm_set1_ps(params.mismatchFactor_)), _mm_andnot_ps(mismatch, one));
+    forceModulus = _mm_mul_ps(forceModulus, factor);
+
+    __m128 neighborForceX = _mm_mul_ps(forceModulus, _mm_div_ps(dx, distance));
+    __m128 neighborForceY = _mm_mul_ps(forceModulus, _mm_div_ps(dy, distance));
+
+    accX = _mm_sub_ps(accX, _mm_and_ps(interacts, neighborForceX));
+    accY = _mm_sub_ps(accY, _mm_and_ps(interacts, neighborForceY));
+}
+
+// Складывает 4 дорожки в том же порядке, что и ReduceLanes (дорожки l и l + 4 уже сложены).
+static inline float ReduceSSE(__m128 r)
+{
+    __m128 s = _mm_add_ps(r, _mm_movehl_ps(r, r));
+    __m128 total = _mm_add_ss(s, _mm_shuffle_ps(s, s, _MM_SHUFFLE(1, 1, 1, 1)));
+    return _mm_cvtss_f32(total);
+}
+
+static bool ComputeRepulsionSSE(const RepulsionParams& params, float x, float y, float color, float id,
+    const NeighborBatch& neighbors, float& forceX, float& forceY)
+{
+    __m128 vx = _mm_set1_ps(x);
+    __m128 vy = _mm_set1_ps(y);
+    __m128 vcolor = _mm_set1_ps(color);
+    __m128 vid = _mm_set1_ps(id);
+
+    // Дорожки 0-3 и 4-7.
+    __m128 accX0 = _mm_setzero_ps();
+    __m128 accY0 = _mm_setzero_ps();
+    __m128 accX1 = _mm_setzero_ps();
+    __m128 accY1 = _mm_setzero_ps();
+    __m128 coincident = _mm_setzero_ps();
+
+    for (int k = 0; k < neighbors.size_; k += FORCE_KERNEL_WIDTH)
+    {
+        RepulsionSSE4(params, vx, vy, vcolor, vid, neighbors, k, accX0, accY0, coincident);
+        RepulsionSSE4(params, vx, vy, vcolor, vid, neighbors, k + 4, accX1, accY1, coincident);
+    }
+
+    forceX = ReduceSSE(_mm_add_ps(accX0, accX1));
+    forceY = ReduceSSE(_mm_add_ps(accY0, accY1));
+    return _mm_movemask_ps(coincident) != 0;
+}
+#endif
+
+#ifdef KERNELS_AVX
+AVX_TARGET static bool ComputeRepulsionAVX(const RepulsionParams& params, float x, float y, float color, float id,
+    const NeighborBatch& neighbors, float& forceX, float& forceY)
+{
+    __m256 vx = _mm256_set1_ps(x);
+    __m256 vy = _mm256_set1_ps(y);
+    __m256 vcolor = _mm256_set1_ps(color);
+    __m256 vid = _mm256_set1_ps(id);
+    __m256 range = _mm256_set1_ps(params.range_);
+    __m256 strength = _mm256_set1_ps(params.strength_);
+    __m256 mismatchFactor = _mm256_set1_ps(params.mismatchFactor_);
+    __m256 coincidenceDistance = _mm256_set1_ps(COINCIDENCE_DISTANCE);
+    __m256 one = _mm256_set1_ps(1.0f);
+
+    __m256 accX = _mm256_setzero_ps();
+    __m256 accY = _mm256_setzero_ps();
+    __m256 coincident = _mm256_setzero_ps();
+
+    for (int k = 0; k < neighbors.size_; k += FORCE_KERNEL_WIDTH)
+    {
+        __m256 dx = _mm256_sub_ps(_mm256_loadu_ps(neighbors.x_ + k), vx);
+        __m256 dy = _mm256_sub_ps(_mm256_loadu_ps(neighbors.y_ + k), vy);
+        __m256 distance = _mm256_sqrt_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)));
+
+        __m256 other = _mm256_cmp_ps(_mm256_loadu_ps(neighbors.id_ + k), vid, _CMP_NEQ_UQ);
+        __m256 tooClose = _mm256_cmp_ps(distance, coincidenceDistance, _CMP_LE_OQ);
+        __m256 interacts = _mm256_andnot_ps(tooClose, _mm256_and_ps(other, _mm256_cmp_ps(distance, range, _CMP_LT_OQ)));
+        coincident = _mm256_or_ps(coincident, _mm256_and_ps(other, tooClose));
+
+        __m256 forceModulus = _mm256_sub_ps(one, _mm256_div_ps(distance, range));
+        forceModulus = _mm256_mul_ps(_mm256_mul_ps(forceModulus, forceModulus), forceModulus);
+        forceModulus = _mm256_mul_ps(forceModulus, strength);
+        __m256 mismatch = _mm256_cmp_ps(_mm256_loadu_ps(neighbors.color_ + k), vcolor, _CMP_NEQ_UQ);
+        forceModulus = _mm256_mul_ps(forceModulus, _mm256_blendv_ps(one, mismatchFactor, mismatch));
+
+        __m256 neighborForceX = _mm256_mul_ps(forceModulus, _mm256_div_ps(dx, distance));
+        __m256 neighborForceY = _mm256_mul_ps(forceModulus, _mm256_div_ps(dy, distance));
+
+        accX = _mm256_sub_ps(accX, _mm256_and_ps(interacts, neighborForceX));
+        accY = _mm256_sub_ps(accY, _mm256_and_ps(interacts, neighborForceY));
+    }
+
+    // Складываем дорожки l и l + 4, затем как в ReduceLanes.
+    __m128 rx = _mm_add_ps(_mm256_castps256_ps128(accX), _mm256_extractf128_ps(accX, 1));
+    __m128 ry = _mm_add_ps(_mm256_castps256_ps128(accY), _mm256_extractf128_ps(accY, 1));
+    __m128 sx = _mm_add_ps(rx, _mm_movehl_ps(rx, rx));
+    __m128 sy = _mm_add_ps(ry, _mm_movehl_ps(ry, ry));
+    forceX = _mm_cvtss_f32(_mm_add_ss(sx, _mm_shuffle_ps(sx, sx, _MM_SHUFFLE(1, 1, 1, 1))));
+    forceY = _mm_cvtss_f32(_mm_add_ss(sy, _mm_shuffle_ps(sy, sy, _MM_SHUFFLE(1, 1, 1, 1))));
+
+    return _mm256_movemask_ps(coincident) != 0;
+}
+#endif
+
+#ifdef KERNELS_NEON
+// Обрабатывает 4 соседа, начиная с k.
+static inline void RepulsionNEON4(const RepulsionParams& params, float32x4_t x, float32x4_t y, float32x4_t color,
+    float32x4_t id, const NeighborBatch& neighbors, int k, float32x4_t& accX, float32x4_t& accY, uint32x4_t& coincident)
+{
+    float32x4_t range = vdupq_n_f32(params.range_);
+    float32x4_t one = vdupq_n_f32(1.0f);
+
+    float32x4_t dx = vsubq_f32(vld1q_f32(neighbors.x_ + k), x);
+    float32x4_t dy = vsubq_f32(vld1q_f32(neighbors.y_ + k), y);
+    float32x4_t distance = vsqrtq_f32(vaddq_f32(vmulq_f32(dx, dx), vmulq_f32(dy, dy)));
+
+    uint32x4_t other = vmvnq_u32(vceqq_f32(vld1q_f32(neighbors.id_ + k), id));
+    uint32x4_t tooClose = vcleq_f32(distance, vdupq_n_f32(COINCIDENCE_DISTANCE));
+    uint32x4_t interacts = vbicq_u32(vandq_u32(other, vcltq_f32(distance, range)), tooClose);
+    coincident = vorrq_u32(coincident, vandq_u32(other, tooClose));
+
+    float32x4_t forceModulus = vsubq_f32(one, vdivq_f32(distance, range));
+    forceModulus = vmulq_f32(vmulq_f32(forceModulus, forceModulus), forceModulus);
+    forceModulus = vmulq_f32(forceModulus, vdupq_n_f32(params.strength_));
+    uint32x4_t mismatch = vmvnq_u32(vceqq_f32(vld1q_f32(neighbors.color_ + k), color));
+    forceModulus = vmulq_f32(forceModulus, vbslq_f32(mismatch, vdupq_n_f32(params.mismatchFactor_), one));
+
+    float32x4_t neighborForceX = vmulq_f32(forceModulus, vdivq_f32(dx, distance));
+    float32x4_t neighborForceY = vmulq_f32(forceModulus, vdivq_f32(dy, distance));
+
+    accX = vsubq_f32(accX, vreinterpretq_f32_u32(vandq_u32(interacts, vreinterpretq_u32_f32(neighborForceX))));
+    accY = vsubq_f32(accY, vreinterpretq_f32_u32(vandq_u32(interacts, vreinterpretq_u32_f32(neighborForceY))));
+}
+
+// Складывает 4 дорожки в том же порядке, что и ReduceLanes (дорожки l и l + 4 уже сложены).
+static inline float ReduceNEON(float32x4_t r)
+{
+    float32x2_t s = vadd_f32(vget_low_f32(r), vget_high_f32(r));
+    return vget_lane_f32(s, 0) + vget_lane_f32(s, 1);
+}
+
+static bool ComputeRepulsionNEON(const RepulsionParams& params, float x, float y, float color, float id,
+    const NeighborBatch& neighbors, float& forceX, float& forceY)
+{
+    float32x4_t vx = vdupq_n_f32(x);
+    float32x4_t vy = vdupq_n_f32(y);
+    float32x4_t vcolor = vdupq_n_f32(color);
+    float32x4_t vid = vdupq_n_f32(id);
+
+    float32x4_t accX0 = vdupq_n_f32(0.0f);
+    float32x4_t accY0 = vdupq_n_f32(0.0f);
+    float32x4_t accX1 = vdupq_n_f32(0.0f);
+    float32x4_t accY1 = vdupq_n_f32(0.0f);
+    uint32x4_t coincident = vdupq_n_u32(0);
+
+    for (int k = 0; k < neighbors.size_; k += FORCE_KERNEL_WIDTH)
+    {
+        RepulsionNEON4(params, vx, vy, vcolor, vid, neighbors, k, accX0, accY0, coincident);
+        RepulsionNEON4(params, vx, vy, vcolor, vid, neighbors, k + 4, accX1, accY1, coincident);
+    }
+
+    forceX = ReduceNEON(vaddq_f32(accX0, accX1));
+    forceY = ReduceNEON(vaddq_f32(accY0, accY1));
+    return vmaxvq_u32(coincident) != 0;
+}
+#endif
+
+bool IsForceKernelSupported(ForceKernel kernel)
+{
+    switch (kernel)
+    {
+    case FK_SCALAR:
+        return true;
+
+#ifdef KERNELS_SSE
+    case FK_SSE:
+        return true;
+#endif
+
+#ifdef KERNELS_AVX
+    case FK_AVX:
+    {
+#ifdef _MSC_VER
+        // Процессор должен поддерживать AVX, а операционная система - сохранять его регистры.
+        int info[4];
+        __cpuid(info, 1);
+        bool avx = (info[2] & (1 << 28)) != 0;
+        bool osxsave = (info[2] & (1 << 27)) != 0;
+        return avx && osxsave && (_xgetbv(0) & 6) == 6;
+#else
+        return __builtin_cpu_supports("avx") != 0;
+#endif
+    }
+#endif
+
+#ifdef KERNELS_NEON
+    case FK_NEON:
+        return true;
+#endif
+
+    default:
+        return false;
+    }
+}
+
+ForceKernel GetBestForceKernel()
+{
+    if (IsForceKernelSupported(FK_AVX))
+        return FK_AVX;
+
+    if (IsForceKernelSupported(FK_SSE))
+        return FK_SSE;
+
+    if (IsForceKernelSupported(FK_NEON))
+        return FK_NEON;
+
+    return FK_SCALAR;
+}
+
+const char* GetForceKernelName(ForceKernel kernel)
+{
+    switch (kernel)
+    {
+    case FK_SSE:
+        return "SSE";
+    case FK_AVX:
+        return "AVX";
+    case FK_NEON:
+        return "NEON";
+    default:
+        return "Scalar";
+    }
+}
+
+bool GetForceKernelByName(const char* name, ForceKernel& kernel)
+{
+    for (int i = FK_SCALAR; i <= FK_NEON; i++)
+    {
+        if (String::Compare(name, GetForceKernelName((ForceKernel)i), false) == 0)
+        {
+            kernel = (ForceKernel)i;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool ComputeRepulsion(ForceKernel kernel, const RepulsionParams& params, float x, float y, float color, float id,
+    const NeighborBatch& neighbors, float& forceX, float& forceY)
+{
+    switch (kernel)
+    {
+#ifdef KERNELS_SSE
+    case FK_SSE:
+        return ComputeRepulsionSSE(params, x, y, color, id, neighbors, forceX, forceY);
+#endif
+
+#ifdef KERNELS_AVX
+    case FK_AVX:
+        return ComputeRepulsionAVX(params, x, y, color, id, neighbors, forceX, forceY);
+#endif
+
+#ifdef KERNELS_NEON
+    case FK_NEON:
+        return ComputeRepulsionNEON(params, x, y, color, id, neighbors, forceX, forceY);
+#endif
+
+    default:
+        return ComputeRepulsionScalar(params, x, y, color, id, neighbors, forceX, forceY);
+    }
+}
@@ -0,0 +1,69 @@
+/*
+Векторизованное вычисление сил отталкивания между молекулами.
+
+Силы считаются "сбором": для одной молекулы суммируются вклады всех ее соседей.
+Соседи передаются плотными массивами, а суммирование идет по восьми независимым
+дорожкам (сосед с номером k попадает в дорожку k % 8), которые затем складываются
+в фиксированном порядке. Скалярная реализация повторяет ровно ту же
+последовательность операций, поэтому все реализации дают побитово одинаковый
+результат (если компилятор не объединяет умножение и сложение в FMA,
+см. -ffp-contract=off в CMakeLists.txt).
+*/
+
+#pragma once
+
+// Число соседей, обрабатываемых за одну итерацию. Размер массивов соседей
+// должен быть кратен этому числу.
+#define FORCE_KERNEL_WIDTH 8
+
+enum ForceKernel
+{
+    // Эталонная скалярная реализация. Доступна всегда.
+    FK_SCALAR,
+    // 4 соседа за инструкцию.
+    FK_SSE,
+    // 8 соседей за инструкцию.
+    FK_AVX,
+    // 4 соседа за инструкцию (только AArch64, так как в ARMv7 нет векторных sqrt и деления).
+    FK_NEON
+};
+
+// Параметры закона отталкивания.
+struct RepulsionParams
+{
+    // Расстояние, на котором молекулы перестают взаимодействовать.
+    float range_;
+    // Множитель силы отталкивания.
+    float strength_;
+    // Дополнительный множитель для молекул разного цвета.
+    float mismatchFactor_;
+};
+
+// Соседи молекулы. Цвет и идентификатор хранятся как float, чтобы их можно было
+// сравнивать теми же инструкциями, что и координаты (в AVX нет 256-битного
+// целочисленного сравнения). Лишние элементы в конце массивов должны быть
+// заполнены далекими точками, которые не взаимодействуют с молекулой.
+struct NeighborBatch
+{
+    const float* x_;
+    const float* y_;
+    const float* color_;
+    const float* id_;
+    int size_;
+};
+
+// Поддерживает ли процессор данную реализацию.
+bool IsForceKernelSupported(ForceKernel kernel);
+// Самая быстрая реализация, поддерживаемая процессором.
+ForceKernel GetBestForceKernel();
+// Имя реализации для логов и отчетов.
+const char* GetForceKernelName(ForceKernel kernel);
+// Реализация по имени (без учета регистра). Возвращает false, если имя неизвестно.
+bool GetForceKernelByName(const char* name, ForceKernel& kernel);
+
+// Суммирует силы отталкивания, действующие на молекулу со стороны соседей.
+// Сосед с тем же идентификатором (сама молекула) пропускается.
+// Соседи, совпадающие с молекулой по позиции, тоже пропускаются, и в этом случае
+// функция возвращает true, чтобы вызывающий код мог разлепить такие молекулы.
+bool ComputeRepulsion(ForceKernel kernel, const RepulsionParams& params, float x, float y, float color, float id,
+    const NeighborBatch& neighbors, float& forceX, float& forceY);
@@ -0,0 +1,140 @@
+#include "Replay.h"
+#include "ContainerLogic.h"
+
+// Идентификатор файлов с записями.
+static const char* REPLAY_FILE_ID = "PRPL";
+// Версия формата. Увеличивается при любом изменении структуры файла или расчета
+// физики (старые записи все равно не совпадут с новым расчетом).
+// 2 - молекулы засыпают.
+// 3 - силы считаются по спискам соседей (другой порядок суммирования).
+// 4 - способ интегрирования, затухание не зависит от длины шага.
+// 5 - форма ёмкости в уровне.
+static const unsigned REPLAY_FILE_VERSION = 5;
+// Размер данных одной заливки в файле.
+static const unsigned FILL_DATA_SIZE = sizeof(unsigned) * 2 + sizeof(unsigned char);
+
+bool ReadReplay(Deserializer& source, Replay& replay)
+{
+    if (source.ReadFileID() != REPLAY_FILE_ID)
+    {
+        URHO3D_LOGERROR(source.GetName() + " is not a valid replay file");
+        return false;
+    }
+
+    unsigned version = source.ReadUInt();
+    if (version != REPLAY_FILE_VERSION)
+    {
+        URHO3D_LOGERRORF("Unsupported replay file version %u in %s", version, source.GetName().CString());
+        return false;
+    }
+
+    replay.seed_ = source.ReadUInt();
+    replay.physicsRate_ = source.ReadInt();
+    replay.integrator_ = source.ReadUByte();
+
+    if (!ReadLevelData(source, replay.level_))
+        return false;
+
+    unsigned numFills = source.ReadUInt();
+
+    // Защищаемся от обрезанных файлов, прежде чем выделять память.
+    if (numFills > (source.GetSize() - source.GetPosition()) / FILL_DATA_SIZE)
+    {
+        URHO3D_LOGERROR(source.GetName() + " is truncated");
+        return false;
+    }
+
+    replay.fills_.Resize(numFills);
+
+    for (unsigned i = 0; i < numFills; i++)
+    {
+        ReplayFill& fill = replay.fills_[i];
+        fill.step_ = source.ReadUInt();
+        fill.molecule_ = source.ReadUInt();
+        fill.color_ = source.ReadUByte();
+    }
+
+    replay.numSteps_ = source.ReadUInt();
+    replay.finalHash_ = source.ReadUInt();
+
+    // Заливки должны идти по порядку и относиться к существующим молекулам.
+    unsigned prevStep = 0;
+    for (const ReplayFill& fill : replay.fills_)
+    {
+        if (fill.step_ < prevStep || fill.step_ > replay.numSteps_ || fill.molecule_ < 0
+            || fill.molecule_ >= replay.level_.GetNumMolecules() || fill.color_ >= NUM_COLORS)
+        {
+            URHO3D_LOGERROR(source.GetName() + " contains an invalid fill");
+            return false;
+        }
+
+        prevStep = fill.step_;
+    }
+
+    if (replay.physicsRate_ <= 0)
+    {
+        URHO3D_LOGERROR(source.GetName() + " has an invalid physics rate");
+        return false;
+    }
+
+    if (replay.integrator_ != PI_SEMI_IMPLICIT_EULER && replay.integrator_ != PI_VELOCITY_VERLET)
+    {
+        URHO3D_LOGERROR(source.GetName() + " has an unknown integrator");
+        return false;
+    }
+
+    return true;
+}
+
+bool WriteReplay(Serializer& dest, const Replay& replay)
+{
+    bool success = true;
+    success &= dest.WriteFileID(REPLAY_FILE_ID);
+    success &= dest.WriteUInt(REPLAY_FILE_VERSION);
+    success &= dest.WriteUInt(replay.seed_);
+    success &= dest.WriteInt(replay.physicsRate_);
+    success &= dest.WriteUByte((unsigned char)replay.integrator_);
+    success &= WriteLevelData(dest, replay.level_);
+    success &= dest.WriteUInt(replay.fills_.Size());
+
+    for (const ReplayFill& fill : replay.fills_)
+    {
+        success &= dest.WriteUInt(fill.step_);
+        success &= dest.WriteUInt(fill.molecule_);
+        success &= dest.WriteUByte((unsigned char)fill.color_);
+    }
+
+    success &= dest.WriteUInt(replay.numSteps_);
+    success &= dest.WriteUInt(replay.finalHash_);
+    return success;
+}
+
+// Добавляет байты к хешу FNV-1a.
+static unsigned HashBytes(unsigned hash, const void* data, unsigned size)
+{
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+
+    for (unsigned i = 0; i < size; i++)
+    {
+        hash ^= bytes[i];
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+unsigned HashLevelData(const LevelData& level)
+{
+    unsigned numMolecules = level.GetNumMolecules();
+
+    unsigned hash = 2166136261u;
+    hash = HashBytes(hash, &level.containerRadius_, sizeof(float));
+    hash = HashBytes(hash, level.containerShape_.Buffer(), level.containerShape_.Size() * sizeof(Vector2));
+    hash = HashBytes(hash, &level.turns_, sizeof(int));
+    hash = HashBytes(hash, level.posX_.Buffer(), numMolecules * sizeof(float));
+    hash = HashBytes(hash, level.posY_.Buffer(), numMolecules * sizeof(float));
+    hash = HashBytes(hash, level.speedX_.Buffer(), numMolecules * sizeof(float));
+    hash = HashBytes(hash, level.speedY_.Buffer(), numMolecules * sizeof(float));
+    hash = HashBytes(hash, level.colors_.Buffer(), numMolecules);
+    return hash;
+}
@@ -0,0 +1,53 @@
+/*
+Запись прохождения уровня для воспроизведения.
+Физика детерминирована: шаг фиксированный, силы суммируются в фиксированном порядке
+(см. MoleculeKernels.h), а у ContainerLogic собственный генератор случайных чисел.
+Поэтому для воспроизведения достаточно начального состояния ёмкости, зерна генератора
+и списка заливок с номерами шагов физики, на которых они были сделаны. Конечное
+состояние не хранится, записывается только его хеш для проверки.
+
+Структура файла (все числа в порядке байтов little-endian):
+    "PRPL"                  идентификатор
+    uint32                  версия формата
+    uint32                  зерно генератора
+    int32                   число шагов физики в секунду
+    uint8                   способ интегрирования (PhysicsIntegrator)
+    уровень                 начальное состояние в формате .lvl (см. LevelFile.h)
+    uint32                  число заливок M
+    M x (uint32 шаг, uint32 молекула, uint8 цвет)
+    uint32                  число шагов до конца записи
+    uint32                  хеш конечного состояния
+*/
+
+#pragma once
+#include "LevelFile.h"
+
+// Расширение файлов с записями.
+#define REPLAY_FILE_EXTENSION ".rpl"
+
+// Заливка, сделанная игроком.
+struct ReplayFill
+{
+    // Номер шага физики от начала записи, после которого была сделана заливка.
+    unsigned step_;
+    int molecule_;
+    int color_;
+};
+
+struct Replay
+{
+    unsigned seed_ = 0;
+    int physicsRate_ = 0;
+    int integrator_ = 0;
+    LevelData level_;
+    PODVector<ReplayFill> fills_;
+    unsigned numSteps_ = 0;
+    unsigned finalHash_ = 0;
+};
+
+// Читает запись. Возвращает false, если файл поврежден или имеет другую версию.
+bool ReadReplay(Deserializer& source, Replay& replay);
+// Записывает запись.
+bool WriteReplay(Serializer& dest, const Replay& replay);
+// Хеш состояния ёмкости. Совпадает, только если все массивы совпадают побитово.
+unsigned HashLevelData(const LevelData& level);
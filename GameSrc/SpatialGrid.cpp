@@ -0,0 +1,46 @@
+#include "SpatialGrid.h"
+
+void SpatialGrid::Build(const float* posX, const float* posY, int numPoints, float cellSize,
+    float minX, float minY, float maxX, float maxY)
+{
+    minX_ = minX;
+    minY_ = minY;
+    invCellSize_ = 1.0f / cellSize;
+    width_ = Max((int)ceilf((maxX - minX) * invCellSize_), 1);
+    height_ = Max((int)ceilf((maxY - minY) * invCellSize_), 1);
+
+    int numCells = width_ * height_;
+
+    // Подсчитываем число точек в каждой ячейке.
+    cellStart_.Resize(numCells + 1);
+    for (int i = 0; i <= numCells; i++)
+        cellStart_[i] = 0;
+
+    pointCells_.Resize(numPoints);
+    for (int i = 0; i < numPoints; i++)
+    {
+        int cell = GetCellIndex(GetCellX(posX[i]), GetCellY(posY[i]));
+        pointCells_[i] = cell;
+        cellStart_[cell + 1]++;
+    }
+
+    // Превращаем количества в смещения.
+    for (int i = 0; i < numCells; i++)
+        cellStart_[i + 1] += cellStart_[i];
+
+    // Раскладываем точки. Точки перебираются по возрастанию индекса,
+    // поэтому внутри ячейки они тоже упорядочены по возрастанию.
+    // В качестве счетчиков заполнения временно используем начала ячеек.
+    cellPoints_.Resize(numPoints);
+    for (int i = 0; i < numPoints; i++)
+    {
+        int cell = pointCells_[i];
+        cellPoints_[cellStart_[cell]++] = i;
+    }
+
+    // После раскладки cellStart_[cell] указывает на начало следующей ячейки.
+    // Сдвигаем массив обратно.
+    for (int i = numCells; i > 0; i--)
+        cellStart_[i] = cellStart_[i - 1];
+    cellStart_[0] = 0;
+}
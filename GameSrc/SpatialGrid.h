@@ -0,0 +1,50 @@
+/*
+Равномерная сетка для быстрого поиска соседних молекул.
+Сетка перестраивается целиком (сортировкой подсчетом), поэтому
+перестроение дешевое и его можно выполнять каждый шаг физики.
+*/
+
+#pragma once
+#include <Urho3D/Urho3DAll.h>
+
+class SpatialGrid
+{
+public:
+    // Раскладывает точки по ячейкам. Сетка покрывает прямоугольник от (minX, minY) до (maxX, maxY).
+    // Точки за пределами прямоугольника попадают в крайние ячейки, так что ни одна
+    // точка не теряется (просто для таких точек будет больше кандидатов в соседи).
+    void Build(const float* posX, const float* posY, int numPoints, float cellSize,
+        float minX, float minY, float maxX, float maxY);
+
+    // Размеры сетки в ячейках.
+    int GetWidth() const { return width_; }
+    int GetHeight() const { return height_; }
+
+    // Координаты ячейки, в которую попадает точка. Ограничение выполняется до преобразования
+    // в int, поэтому отбрасывание дробной части здесь равносильно округлению вниз.
+    int GetCellX(float x) const { return (int)Clamp((x - minX_) * invCellSize_, 0.0f, (float)(width_ - 1)); }
+    int GetCellY(float y) const { return (int)Clamp((y - minY_) * invCellSize_, 0.0f, (float)(height_ - 1)); }
+    int GetCellIndex(int cellX, int cellY) const { return cellY * width_ + cellX; }
+
+    // Индексы точек ячейки находятся в диапазоне [GetCellBegin(cell), GetCellEnd(cell)).
+    // Внутри ячейки индексы точек упорядочены по возрастанию.
+    const int* GetCellBegin(int cell) const { return cellPoints_.Buffer() + cellStart_[cell]; }
+    const int* GetCellEnd(int cell) const { return cellPoints_.Buffer() + cellStart_[cell + 1]; }
+    // Индексы всех точек, упорядоченные по ячейкам (ячейки идут по строкам).
+    const int* GetPoints() const { return cellPoints_.Buffer(); }
+
+private:
+    int width_ = 0;
+    int height_ = 0;
+    float minX_ = 0.0f;
+    float minY_ = 0.0f;
+    float invCellSize_ = 1.0f;
+
+    // Ячейка, в которую попала каждая точка.
+    PODVector<int> pointCells_;
+    // Для каждой ячейки смещение ее первой точки в cellPoints_. Последний элемент
+    // равен общему числу точек.
+    PODVector<int> cellStart_;
+    // Индексы точек, отсортированные по ячейкам.
+    PODVector<int> cellPoints_;
+};
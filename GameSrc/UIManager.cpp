@@ -3,6 +3,7 @@
 #include "Utils.h"
 #include "ContainerLogic.h"
 #include "Config.h"
+#include "FrameProfiler.h"
 
 #define NEXT_BUTTON_NORMAL_POS IntVector2(-250, 310)
 
@@ -176,8 +177,8 @@ void UIManager::HandlePrevButtonClick(StringHash eventType, VariantMap& eventDat
 
 void UIManager::HandleReplayButtonClick(StringHash eventType, VariantMap& eventData)
 {
-    // Сцена будет загружена заново.
-    GLOBAL->currentLevelIndex_ = -1;
+    // Уровень будет перезапущен.
+    GLOBAL->neededRestartLevel_ = true;
 
     if (GLOBAL->gameState_ == GS_WIN)
         GLOBAL->neededGameState_ = GS_PLAY;
@@ -229,6 +230,8 @@ void UIManager::SavePositionToVar(UIElement* element)
 
 void UIManager::HandlePostUpdate(StringHash eventType, VariantMap& eventData)
 {
+    FRAME_PROFILE(UIManagerPostUpdate);
+
     float timeStep = eventData[PostUpdate::P_TIMESTEP].GetFloat();
 
     UpdateElementsVisibility();
@@ -276,15 +279,8 @@ void UIManager::UpdateNextLevelButtonPos(float timeStep)
 
 bool UIManager::IsAvailableNextLevel()
 {
-    int effectiveLevelIndex = GLOBAL->currentLevelIndex_;
-
-    // GLOBAL->currentLevelIndex_ == -1 только в случае перезапуска текущего уровня.
-    // При этом реальный номер уровня сохранен в GLOBAL->neededLevelIndex_.
-    if (effectiveLevelIndex == -1)
-        effectiveLevelIndex = GLOBAL->neededLevelIndex_;
-
     // Больше уровней нет.
-    if (effectiveLevelIndex + 1 >= CONFIG->GetNumLevels())
+    if (GLOBAL->currentLevelIndex_ + 1 >= CONFIG->GetNumLevels())
         return false;
 
     // В режиме редактора можно свободно переходить между уровнями.
@@ -292,7 +288,7 @@ bool UIManager::IsAvailableNextLevel()
         return true;
 
     // Текущий уровень еще не пройден.
-    if (CONFIG->numCompletedLevels_ <= effectiveLevelIndex)
+    if (CONFIG->numCompletedLevels_ <= GLOBAL->currentLevelIndex_)
         return false;
 
     return true;
@@ -300,12 +296,7 @@ bool UIManager::IsAvailableNextLevel()
 
 bool UIManager::IsAvailablePrevLevel()
 {
-    int effectiveLevelIndex = GLOBAL->currentLevelIndex_;
-
-    if (effectiveLevelIndex == -1)
-        effectiveLevelIndex = GLOBAL->neededLevelIndex_;
-
-    if (effectiveLevelIndex == 0)
+    if (GLOBAL->currentLevelIndex_ == 0)
         return false;
 
     return true;
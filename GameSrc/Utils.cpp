@@ -48,3 +48,13 @@ Vector2 ToTarget(const Vector2& currentPosition, const Vector2& targetPosition,
     
     return newPosition;
 }
+
+Vector3 RandomPointInCircle(float minDistance, float maxDistance)
+{
+    // Случайное расстояние от центра.
+    float dist = Random(minDistance, maxDistance);
+    // Случайный угол.
+    float angle = Random(0.0f, 360.0f);
+    // Итоговая координата.
+    return Vector3(dist * sin(angle), dist * cos(angle), 0.0f);
+}
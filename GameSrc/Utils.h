@@ -6,3 +6,6 @@ float ToTarget(float currentValue, float targetValue, float speed, float timeSte
 
 // Плавное изменение позиции в сторону пункта назначения с определенной скоростью.
 Vector2 ToTarget(const Vector2& currentPosition, const Vector2& targetPosition, float speed, float timeStep);
+
+// Случайная точка на плоскости XOY на расстоянии от minDistance до maxDistance от начала координат.
+Vector3 RandomPointInCircle(float minDistance, float maxDistance);